@@ -2,16 +2,30 @@
 // Author: Ji ZHOU
 
 #include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
 #include <iostream>
+#include <iterator>
 #include <map>
 #include <set>
+#include <sstream>
 #include <string>
+#include <thread>
 #include <utility>
 #include <vector>
 using namespace std;
 
+// 编译时可以用 -DSHUDU_MAX_SIZE=<n> 调整棋盘最大边长，
+// 超过64时候选数掩码会使用多个机器字。
+#ifndef SHUDU_MAX_SIZE
+#define SHUDU_MAX_SIZE 64
+#endif
+
 const int NO_VAL = 0;
-const int MAX_SIZE = 35;      // 棋盘最大边长
+const int MAX_SIZE = SHUDU_MAX_SIZE;  // 棋盘最大边长
+const int MAX_CHAR_VAL = 35;          // 能用单个字符（1-9、A-Z）表示的最大数值
 
 template <typename T>
 struct FlagVar {
@@ -27,6 +41,7 @@ struct FlagVar {
 typedef vector<const char*> StrVec;
 typedef map<string, FlagVar<bool> > FlagsBool;
 typedef map<string, FlagVar<int> > FlagsInt;
+typedef map<string, FlagVar<string> > FlagsString;
 
 template <typename T>
 T InitFlag(T &var, T defVal, const char *strDefVal, const char *tag,
@@ -41,6 +56,7 @@ T InitFlag(T &var, T defVal, const char *strDefVal, const char *tag,
 StrVec g_all_tags;
 FlagsBool g_flags_bool;
 FlagsInt g_flags_int;
+FlagsString g_flags_string;
 
 #define DEF_FLAG_BOOL(tag, defval, desc)            \
     bool g_##tag = InitFlag<bool>(                  \
@@ -52,8 +68,41 @@ FlagsInt g_flags_int;
         g_##tag, defval, #defval, #tag,             \
         g_flags_int, desc, g_all_tags);
 
+#define DEF_FLAG_STRING(tag, defval, desc)          \
+    string g_##tag = InitFlag<string>(              \
+        g_##tag, defval, #defval, #tag,             \
+        g_flags_string, desc, g_all_tags);
+
 DEF_FLAG_BOOL(better_print_1, true, "使用棋盘格式打印解棋局。");
 DEF_FLAG_BOOL(better_print_2, true, "使用棋盘格式打印未完成棋局。");
+DEF_FLAG_BOOL(jigsaw, false,
+              "锯齿数独：初始棋盘之后再读入同样大小的宫格划分，"
+              "用相同字符（或数）表示的方格属于同一宫格。");
+DEF_FLAG_STRING(variant, "",
+                "附加区域，可以是diagonal（两条对角线）、windoku（窗口宫格）、"
+                "disjoint（同位组）中的一个或多个，以逗号分隔。");
+DEF_FLAG_BOOL(killer, false,
+              "杀手数独：初始棋盘（及宫格划分）之后再读入同样大小的笼子划分，"
+              "用相同字符（或数）表示的方格属于同一笼子，.表示不属于任何笼子；"
+              "然后按笼子第一次出现的顺序读入各笼子的数值之和。");
+DEF_FLAG_BOOL(samurai, false,
+              "武士数独：五个子棋盘呈X形排列，四角的子棋盘各与中央的子棋盘重叠"
+              "一个宫格；按行优先的顺序输入整个外接矩形，不属于任何子棋盘的方格"
+              "可以用任意占位字符（如.）表示。");
+DEF_FLAG_STRING(load_pencil, "",
+                "从指定的候选数文件（文本或二进制格式）读入棋局，代替从标准输入"
+                "读入初始棋盘；宫格划分、笼子等仍从标准输入读入。");
+DEF_FLAG_STRING(dump_pencil, "", "推导结束后将候选数写入指定的文件。");
+DEF_FLAG_BOOL(pencil_binary, false, "以二进制格式写入候选数文件。");
+DEF_FLAG_STRING(marks, "",
+                "依次表示数值1、2、……的字符，为空时使用1-9、A-Z；"
+                "不在其中的字符表示空方格。");
+DEF_FLAG_BOOL(puzzle_files, false,
+              "从标准输入读入棋局文件名，每行一个，依次从各文件读入棋局。"
+              "文件格式同puzzles/*.txt：每个棋盘行占一行，#开头的行为注释，"
+              "读满棋盘行数后其余内容（如说明文字）被忽略。");
+DEF_FLAG_BOOL(token_input, false,
+              "输入的每个方格是以空白分隔的数值（边长超过35时总是如此）。");
 
 DEF_FLAG_BOOL(show_board_deduce, false, "在推导过程中显示棋局。");
 DEF_FLAG_BOOL(show_msg_deduce, true, "在推导过程中显示推理信息。");
@@ -63,46 +112,509 @@ DEF_FLAG_BOOL(show_msg_guess, false, "在猜测过程中显示推理信息。");
 DEF_FLAG_BOOL(disable_naked_deduce, false, "禁用显式规则。");
 DEF_FLAG_BOOL(disable_hidden_deduce, false, "禁用隐式规则。");
 DEF_FLAG_BOOL(disable_lines_deduce, false, "禁用链列规则。");
+DEF_FLAG_BOOL(disable_finned_deduce, false, "禁用带鳍链列规则。");
+DEF_FLAG_BOOL(disable_wing_deduce, false, "禁用翼类规则。");
+DEF_FLAG_BOOL(disable_chain_deduce, false, "禁用单数字链规则。");
+DEF_FLAG_BOOL(disable_als_deduce, false, "禁用ALS-XZ规则。");
+DEF_FLAG_BOOL(disable_forcing_deduce, false, "禁用强制链规则。");
 DEF_FLAG_BOOL(disable_guess, false, "禁用猜测。");
+DEF_FLAG_BOOL(assume_unique, false, "假设题目有唯一解，启用唯一性规则。");
 DEF_FLAG_BOOL(disable_shorten_deduce, false, "禁用规则的短路特性。");
+DEF_FLAG_BOOL(disable_pre_check, false, "禁用推导前的矛盾预检查。");
 
-DEF_FLAG_INT(level_naked_deduce, 35, "显式规则等级，[1, 棋盘边长)。");
-DEF_FLAG_INT(level_hidden_deduce, 35, "隐式规则等级，[1, 棋盘边长)。");
-DEF_FLAG_INT(level_lines_deduce, 35, "链列规则等级，[2, 棋盘边长)。");
+DEF_FLAG_INT(level_naked_deduce, 64, "显式规则等级，[1, 棋盘边长)。");
+DEF_FLAG_INT(level_hidden_deduce, 64, "隐式规则等级，[1, 棋盘边长)。");
+DEF_FLAG_INT(level_lines_deduce, 64, "链列规则等级，[2, 棋盘边长)。");
+DEF_FLAG_INT(level_wing_deduce, 3,
+             "翼类规则等级，[1, 3]：XY-Wing、XYZ-Wing、W-Wing。");
+DEF_FLAG_INT(level_chain_deduce, 6, "单数字链规则等级（强链数目），[2, )。");
+DEF_FLAG_INT(budget_chain_deduce, 20000,
+             "单数字链规则每次推导最多搜索的节点数，[1, )。");
+DEF_FLAG_INT(level_als_deduce, 4, "ALS-XZ规则等级（ALS的方格数），[1, 棋盘边长)。");
+DEF_FLAG_INT(budget_forcing_deduce, 5000,
+             "强制链规则每次推导最多进行的传播步数，[1, )。");
 
 DEF_FLAG_INT(max_solution, 10, "最多允许搜索的解数目，[1, )。");
+DEF_FLAG_BOOL(random_branch, false,
+              "搜索时在候选数最少的方格中随机选择，并打乱候选数的尝试顺序。");
+DEF_FLAG_STRING(restart, "",
+                "搜索的重启策略：luby或geometric，空表示不重启。"
+                "只在max_solution为1时生效，隐含random_branch。");
+DEF_FLAG_INT(restart_nodes, 100, "重启策略中节点数限制的单位，[1, )。");
+DEF_FLAG_STRING(branch, "min",
+                "搜索的分支策略：min为候选数最少的方格；degree在此基础上优先"
+                "选择未确定的同行、列、宫格方格最多的；hidden在某区域内某数值"
+                "的可能位置更少时改为对这些位置分支。");
+DEF_FLAG_BOOL(branch_lcv, false,
+              "搜索时优先尝试从同行、列、宫格中删除候选数最少的分支。");
+DEF_FLAG_BOOL(grid_table, true,
+              "4x4棋盘使用预先生成的完整棋局表直接求解和计数，不进行搜索。");
+DEF_FLAG_BOOL(count, false,
+              "计数模式：只统计解的数目（至多max_solution个），不打印解。");
+DEF_FLAG_BOOL(bench, false,
+              "分支策略评测模式：读入多个棋局，比较各分支策略的假设次数和用时。");
 
+DEF_FLAG_BOOL(show_stats, false, "结束时打印各规则的推导次数。");
+DEF_FLAG_BOOL(grade, false,
+              "难度分级模式：连续读入多个棋局，每个棋局输出一行分级结果。");
+DEF_FLAG_INT(generate, 0, "出题模式：生成指定数目的唯一解棋局，每行一个。");
+DEF_FLAG_INT(gen_clues, 0, "出题时的目标已知数数目，0表示尽量少。");
+DEF_FLAG_STRING(gen_grade, "", "出题时的目标分类，可以是ABCDX中的一个或多个。");
+DEF_FLAG_INT(gen_tries, 1000, "出题时每个棋局最多尝试的完整棋局数目，[1, )。");
+DEF_FLAG_BOOL(reduce, false,
+              "化简模式：连续读入多个唯一解棋局，每个棋局输出一行极小棋局。");
+DEF_FLAG_INT(sample, 0,
+             "取样模式：读入一个棋局，输出指定数目的随机解，每行一个。");
+DEF_FLAG_INT(sample_limit, 100,
+             "取样时每个候选数最多计数的解数目，越大越接近均匀，[1, )。");
+DEF_FLAG_INT(threads, 1, "出题等批量任务使用的线程数，[1, )。");
+DEF_FLAG_INT(seed, 1, "随机数种子，第i个线程使用seed+i。");
 DEF_FLAG_BOOL(help, false, "打印此帮助信息后退出。");
 
 enum Status {S_NORMAL=-1, S_FAILED, S_FINISHED};
+
+// 搜索的重启策略，每次重启前的假设次数限制为restart_nodes乘以：
+// RS_LUBY：Luby序列1, 1, 2, 1, 1, 2, 4, 1, 1, 2, ...
+// RS_GEOMETRIC：1.5的幂1, 1.5, 2.25, ...
+enum RestartSchedule {RS_NONE, RS_LUBY, RS_GEOMETRIC};
+
+RestartSchedule ParseRestart(const string &name) {
+  if (name == "luby") return RS_LUBY;
+  if (name == "geometric") return RS_GEOMETRIC;
+  return RS_NONE;
+}
+
+// 搜索的分支策略。
+enum BranchPolicy {
+  BP_MIN,       // 候选数最少的方格
+  BP_DEGREE,    // 候选数最少，其次未确定的同行、列、宫格方格最多的方格
+  BP_HIDDEN,    // 候选数最少的方格，或可能位置最少的区域和数值
+  BP_END
+};
+const char *BRANCH_POLICY_STR[] = {"min", "degree", "hidden"};
+
+BranchPolicy ParseBranch(const string &name) {
+  for (int ii = 0; ii < BP_END; ++ii)
+    if (name == BRANCH_POLICY_STR[ii]) return (BranchPolicy)ii;
+  return BP_MIN;
+}
+// 变型数独在行、列、宫格之外附加的区域，可以组合使用：
+// VT_DIAGONAL：两条对角线（X数独）；
+// VT_WINDOKU：宫格之间的窗口宫格，9x9棋盘上为左上角位于(2,2)、(2,6)、
+//   (6,2)、(6,6)的四个3x3宫格；
+// VT_DISJOINT：同位组，各宫格内相同位置的方格构成一个区域。
+typedef int Variant;
+const Variant VT_NONE     = 0;
+const Variant VT_DIAGONAL = 1;
+const Variant VT_WINDOKU  = 2;
+const Variant VT_DISJOINT = 4;
+
+// 解析以逗号分隔的变型名称，忽略无法识别的名称。
+Variant ParseVariant(const string &names) {
+  Variant variant = VT_NONE;
+  string::size_type begin = 0;
+  while (begin <= names.size()) {
+    string::size_type end = names.find(',', begin);
+    if (end == string::npos) end = names.size();
+    string name;
+    for (string::size_type ii = begin; ii < end; ++ii)
+      if (!isspace(names[ii])) name += tolower(names[ii]);
+    if (name == "diagonal" || name == "x") variant |= VT_DIAGONAL;
+    if (name == "windoku") variant |= VT_WINDOKU;
+    if (name == "disjoint") variant |= VT_DISJOINT;
+    begin = end + 1;
+  }
+  return variant;
+}
+
 #define CHECK_STATUS(res, finished)     do {            \
     if ((res) == S_FAILED) return S_FAILED;             \
     if ((res) == S_NORMAL) finished = false;            \
   } while (false);
 
-inline char Num2Char(int val) {
-  if (1 <= val && val <= 9) return val - 1 + '1';
-  else if (10 <= val && val <= 35) return val - 10 + 'A';
-  else return 'x';
+// 由g_marks得到的字符到数值的映射，0表示空方格，见SetMarks。
+int g_mark_nums[256];
+
+// 数值的文本表示：设置了g_marks时使用其中的字符，否则不超过MAX_CHAR_VAL的
+// 数值用单个字符表示，更大的数值用十进制数表示。
+inline string Num2Char(int val) {
+  if (!g_marks.empty() && 1 <= val && val <= (int)g_marks.size())
+    return string(1, g_marks[val - 1]);
+  if (1 <= val && val <= 9) return string(1, val - 1 + '1');
+  else if (10 <= val && val <= MAX_CHAR_VAL) return string(1, val - 10 + 'A');
+  else if (val > MAX_CHAR_VAL) {
+    ostringstream oss;
+    oss << val;
+    return oss.str();
+  }
+  else return "x";
 }
 
 inline int Char2Num(char c) {
+  if (!g_marks.empty()) return g_mark_nums[(unsigned char)c];
   if ('1' <= c && c <= '9') return c - '1' + 1;
   else if ('A' <= c && c <= 'Z') return c - 'A' + 10;
   else return 0;
 }
 
-// 区域类型，一个区域可以是一行、一列或一个宫格。
+// 读入一个以空白分隔的数值：单个字符按Char2Num解释，否则按十进制数解释。
+// 空方格可以用x、0、.或*表示。
+inline int Token2Num(const string &token) {
+  if (token.size() == 1) return Char2Num(token[0]);
+  return atoi(token.c_str());
+}
+
+// 多个机器字组成的位掩码，提供与整数相同的位运算接口，用于边长超过64的棋盘。
+template <int W>
+class BitMask {
+ public:
+  BitMask(unsigned long long low=0) {
+    words_[0] = low;
+    for (int ii = 1; ii < W; ++ii) words_[ii] = 0;
+  }
+
+  BitMask operator~() const {
+    BitMask res;
+    for (int ii = 0; ii < W; ++ii) res.words_[ii] = ~words_[ii];
+    return res;
+  }
+  BitMask &operator&=(const BitMask &other) {
+    for (int ii = 0; ii < W; ++ii) words_[ii] &= other.words_[ii];
+    return *this;
+  }
+  BitMask &operator|=(const BitMask &other) {
+    for (int ii = 0; ii < W; ++ii) words_[ii] |= other.words_[ii];
+    return *this;
+  }
+  BitMask &operator^=(const BitMask &other) {
+    for (int ii = 0; ii < W; ++ii) words_[ii] ^= other.words_[ii];
+    return *this;
+  }
+  friend BitMask operator&(BitMask lhs, const BitMask &rhs) {
+    return lhs &= rhs;
+  }
+  friend BitMask operator|(BitMask lhs, const BitMask &rhs) {
+    return lhs |= rhs;
+  }
+  friend BitMask operator^(BitMask lhs, const BitMask &rhs) {
+    return lhs ^= rhs;
+  }
+  friend bool operator==(const BitMask &lhs, const BitMask &rhs) {
+    for (int ii = 0; ii < W; ++ii)
+      if (lhs.words_[ii] != rhs.words_[ii]) return false;
+    return true;
+  }
+  friend bool operator!=(const BitMask &lhs, const BitMask &rhs) {
+    return !(lhs == rhs);
+  }
+
+  void SetBit(int pos) { words_[pos / 64] |= 1ULL << (pos % 64); }
+  bool TestBit(int pos) const {
+    return (words_[pos / 64] & (1ULL << (pos % 64))) != 0;
+  }
+  int Count() const {
+    int cnt = 0;
+    for (int ii = 0; ii < W; ++ii) cnt += __builtin_popcountll(words_[ii]);
+    return cnt;
+  }
+  // 最低的置位位置，掩码为0时返回-1。
+  int Lowest() const {
+    for (int ii = 0; ii < W; ++ii)
+      if (words_[ii] != 0) return ii * 64 + __builtin_ctzll(words_[ii]);
+    return -1;
+  }
+
+ private:
+  unsigned long long words_[W];
+};
+
+// 掩码类型的选择：一个机器字够用时直接使用整数，避免小棋盘的额外开销。
+template <int W>
+struct MaskTraits {
+  typedef BitMask<W> Mask;
+};
+template <>
+struct MaskTraits<1> {
+  typedef unsigned long long Mask;
+};
+
+inline void SetMaskBit(unsigned long long &mask, int pos) {
+  mask |= 1ULL << pos;
+}
+inline bool TestMaskBit(unsigned long long mask, int pos) {
+  return (mask & (1ULL << pos)) != 0;
+}
+inline int MaskCount(unsigned long long mask) {
+  return __builtin_popcountll(mask);
+}
+inline int MaskLowest(unsigned long long mask) {
+  return mask == 0 ? -1 : __builtin_ctzll(mask);
+}
+template <int W>
+inline void SetMaskBit(BitMask<W> &mask, int pos) { mask.SetBit(pos); }
+template <int W>
+inline bool TestMaskBit(const BitMask<W> &mask, int pos) {
+  return mask.TestBit(pos);
+}
+template <int W>
+inline int MaskCount(const BitMask<W> &mask) { return mask.Count(); }
+template <int W>
+inline int MaskLowest(const BitMask<W> &mask) { return mask.Lowest(); }
+
+// 数值集合的位掩码表示，第val-1位为1表示集合中包含数值val。
+typedef MaskTraits<(MAX_SIZE + 63) / 64>::Mask ValMask;
+
+inline ValMask ValBit(int val) {
+  ValMask mask = 0;
+  SetMaskBit(mask, val - 1);
+  return mask;
+}
+
+inline bool HasVal(const ValMask &mask, int val) {
+  return TestMaskBit(mask, val - 1);
+}
+
+inline int BitCount(const ValMask &mask) {
+  return MaskCount(mask);
+}
+
+// 掩码中最小的数值，mask为0时返回NO_VAL。
+inline int MaskToVal(const ValMask &mask) {
+  return mask == 0 ? NO_VAL : MaskLowest(mask) + 1;
+}
+
+// 掩码中的各数值，按从小到大的顺序。
+inline void MaskToVals(ValMask mask, vector<int> &vals) {
+  vals.clear();
+  while (mask != 0) {
+    int val = MaskToVal(mask);
+    vals.push_back(val);
+    mask &= ~ValBit(val);
+  }
+}
+
+// 包含数值1～size的掩码。
+inline ValMask FullMask(int size) {
+  ValMask mask = 0;
+  for (int val = 1; val <= size; ++val) mask |= ValBit(val);
+  return mask;
+}
+
+// 掩码的十六进制表示，固定为(size + 3) / 4位，高位在前。
+string MaskToHex(const ValMask &mask, int size) {
+  static const char DIGITS[] = "0123456789abcdef";
+  string hex;
+  for (int nib = (size - 1) / 4; nib >= 0; --nib) {
+    int digit = 0;
+    for (int bit = 3; bit >= 0; --bit) {
+      int val = nib * 4 + bit + 1;
+      digit = digit * 2 + ((val <= size && HasVal(mask, val)) ? 1 : 0);
+    }
+    hex += DIGITS[digit];
+  }
+  return hex;
+}
+
+// 解析十六进制表示的掩码，返回false表示含有非法字符或超出1～size的数值。
+bool HexToMask(const string &hex, int size, ValMask &mask) {
+  mask = 0;
+  int nibs = hex.size();
+  for (int ii = 0; ii < nibs; ++ii) {
+    char c = tolower(hex[ii]);
+    int digit;
+    if ('0' <= c && c <= '9') digit = c - '0';
+    else if ('a' <= c && c <= 'f') digit = c - 'a' + 10;
+    else return false;
+    for (int bit = 0; bit < 4; ++bit) {
+      if ((digit & (1 << bit)) == 0) continue;
+      int val = (nibs - 1 - ii) * 4 + bit + 1;
+      if (val > size) return false;
+      mask |= ValBit(val);
+    }
+  }
+  return true;
+}
+
+// xorshift64*伪随机数生成器。每个线程各自持有一个实例，相同的种子总是
+// 产生相同的序列，便于复现。
+class Random {
+ public:
+  explicit Random(unsigned long long seed) {
+    // 用splitmix64打散种子，避免相邻的种子产生相近的序列。
+    unsigned long long z = seed + 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    state_ = z ^ (z >> 31);
+    if (state_ == 0) state_ = 1;
+  }
+
+  unsigned long long Next() {
+    state_ ^= state_ >> 12;
+    state_ ^= state_ << 25;
+    state_ ^= state_ >> 27;
+    return state_ * 0x2545F4914F6CDD1DULL;
+  }
+
+  // [0, n)内的随机整数。
+  int Uniform(int n) {
+    return (int)(Next() % (unsigned long long)n);
+  }
+
+  template <typename T>
+  void Shuffle(vector<T> &vec) {
+    for (int ii = (int)vec.size() - 1; ii > 0; --ii)
+      swap(vec[ii], vec[Uniform(ii + 1)]);
+  }
+
+ private:
+  unsigned long long state_;
+};
+
+// 小棋盘的完整棋局表：列出所有合法的完整棋局，对每个方格的每个数值记录一个
+// 位集，第i位为1表示第i个完整棋局在此方格上是这个数值。求解时把各方格允许
+// 的数值对应的位集取并、各方格之间取交，剩下的位就是所有的解，不需要搜索。
+// 位集按机器字逐字运算，编译器可以自动向量化。
+// 2x2宫格（4x4棋盘）只有288个完整棋局。2x3宫格（6x6棋盘）有28200960个，
+// 216个位集共需约760MB，得不偿失，因此只为4x4棋盘建表。
+class GridTable {
+ public:
+  typedef vector<unsigned long long> Bits;
+
+  // 宫格大小为blockx * blocky的表，没有时返回NULL。表在第一次使用时生成，
+  // 此后只读，可以在线程间共享。
+  static const GridTable *Find(int blockx, int blocky) {
+    if (blockx != 2 || blocky != 2) return NULL;
+    static const GridTable table(2, 2);
+    return &table;
+  }
+
+  int GridCnt() const {
+    return grids_.size();
+  }
+
+  // allowed按行优先的顺序给出每个方格允许的数值，结果为符合的棋局的位集。
+  void Match(const vector<ValMask> &allowed, Bits &bits) const {
+    bits.assign(words_, ~0ULL);
+    if (grids_.size() % 64 != 0)
+      bits[words_ - 1] = (1ULL << (grids_.size() % 64)) - 1;
+    Bits cell(words_);
+    for (int ii = 0; ii < size_ * size_; ++ii) {
+      if (allowed[ii] == FullMask(size_)) continue;
+      cell.assign(words_, 0);
+      for (int val = 1; val <= size_; ++val) {
+        if (!HasVal(allowed[ii], val)) continue;
+        const Bits &mask = masks_[ii * size_ + val - 1];
+        for (int ww = 0; ww < words_; ++ww) cell[ww] |= mask[ww];
+      }
+      for (int ww = 0; ww < words_; ++ww) bits[ww] &= cell[ww];
+    }
+  }
+
+  static int Count(const Bits &bits) {
+    int cnt = 0;
+    for (int ww = 0; ww < (int)bits.size(); ++ww) cnt += MaskCount(bits[ww]);
+    return cnt;
+  }
+
+  // 位集中第一个不小于from的棋局序号，没有时返回-1。
+  static int Next(const Bits &bits, int from) {
+    for (int ww = from / 64; ww < (int)bits.size(); ++ww) {
+      unsigned long long word = bits[ww];
+      if (ww == from / 64) word &= ~0ULL << (from % 64);
+      if (word != 0) return ww * 64 + MaskLowest(word);
+    }
+    return -1;
+  }
+
+  // 第idx个完整棋局，按行优先的顺序。
+  const vector<int> &Grid(int idx) const {
+    return grids_[idx];
+  }
+
+ private:
+  GridTable(int blockx, int blocky)
+      : blockx_(blockx), blocky_(blocky), size_(blockx * blocky) {
+    vector<int> grid(size_ * size_, NO_VAL);
+    Enumerate(grid, 0);
+    words_ = (grids_.size() + 63) / 64;
+    masks_.assign(size_ * size_ * size_, Bits(words_, 0));
+    for (int gg = 0; gg < (int)grids_.size(); ++gg)
+      for (int ii = 0; ii < size_ * size_; ++ii)
+        masks_[ii * size_ + grids_[gg][ii] - 1][gg / 64] |= 1ULL << (gg % 64);
+  }
+
+  // 按行优先的顺序逐格回溯，列出所有完整棋局。
+  void Enumerate(vector<int> &grid, int pos) {
+    if (pos == size_ * size_) {
+      grids_.push_back(grid);
+      return;
+    }
+    int x = pos / size_, y = pos % size_;
+    for (int val = 1; val <= size_; ++val) {
+      bool ok = true;
+      for (int ii = 0; ii < pos && ok; ++ii) {
+        int xx = ii / size_, yy = ii % size_;
+        ok = grid[ii] != val ||
+            (xx != x && yy != y &&
+             (xx / blockx_ != x / blockx_ || yy / blocky_ != y / blocky_));
+      }
+      if (!ok) continue;
+      grid[pos] = val;
+      Enumerate(grid, pos + 1);
+    }
+    grid[pos] = NO_VAL;
+  }
+
+  const int blockx_, blocky_, size_;
+  int words_;
+  vector<vector<int> > grids_;  // 所有完整棋局
+  vector<Bits> masks_;          // 第cell*size+val-1个为方格cell是val的位集
+};
+
+// 区域类型，一个区域可以是一行、一列、一个宫格，或变型数独附加的区域。
 typedef int AreaType;
-const AreaType AT_BEGIN = 0;  // 区域类型遍历起始
-const AreaType AT_ROW   = 0;  // 行
-const AreaType AT_COL   = 1;  // 列
-const AreaType AT_BLOCK = 2;  // 宫格
-const AreaType AT_END   = 3;  // 区域类型遍历终止
+const AreaType AT_BEGIN  = 0;  // 区域类型遍历起始
+const AreaType AT_ROW    = 0;  // 行
+const AreaType AT_COL    = 1;  // 列
+const AreaType AT_BLOCK  = 2;  // 宫格
+const AreaType AT_DIAG   = 3;  // 对角线
+const AreaType AT_WINDOW = 4;  // 窗口宫格
+const AreaType AT_GROUP  = 5;  // 同位组
+const AreaType AT_END    = 6;  // 区域类型遍历终止
 const char *AREA_TYPE_STR[] = {
-  "行", "列", "块", "区域"
+  "行", "列", "块", "对角线", "窗口", "同位组", "区域"
 };
 
+// 推导规则的类型，用于统计。
+typedef int DeduceRule;
+const DeduceRule DR_BEGIN  = 0;
+const DeduceRule DR_NAKED  = 0;  // 显式规则
+const DeduceRule DR_HIDDEN = 1;  // 隐式规则
+const DeduceRule DR_LINES  = 2;  // 链列规则
+const DeduceRule DR_FINNED = 3;  // 带鳍链列规则
+const DeduceRule DR_UNIQUE = 4;  // 唯一性规则
+const DeduceRule DR_WING   = 5;  // 翼类规则
+const DeduceRule DR_CHAIN  = 6;  // 单数字链规则
+const DeduceRule DR_ALS    = 7;  // ALS-XZ规则
+const DeduceRule DR_FORCING = 8; // 强制链规则
+const DeduceRule DR_END    = 9;
+const char *DEDUCE_RULE_STR[] = {
+  "显式", "隐式", "链列", "带鳍链列", "唯一性", "翼类", "单数字链", "ALS-XZ",
+  "强制链"
+};
+
+// 难度分数中各规则每次有效推导的代价，以及猜测时每次假设的代价。
+const int DEDUCE_RULE_SCORE[] = {
+  1, 2, 10, 15, 20, 20, 30, 40, 60
+};
+const int GUESS_SCORE = 100;
+
+// 搜索时试探一组方格是否有解所允许的假设次数，见ShuduSolver::ProbeComponent。
+const int PROBE_GUESSES = 64;
+
+// 唯一性规则的细分类型数目：唯一矩形类型1～4，以及BUG+1。
+const int UR_TYPES = 4;
+
 // 设置候选数的操作范围。
 typedef unsigned int OperRange;
 const OperRange OR_CELL       = 0x01;  // 处理指定的方格
@@ -111,31 +623,93 @@ const OperRange OR_OTHER_AREA = 0x04;  // 处理包含指定方格的其他区
 const OperRange OR_AREA       = 0x06;  // 处理所有包含指定方格的区域（同上）
 const OperRange OR_ALL        = 0x07;  // 全部处理
 
+// 预检查发现的矛盾类型。
+typedef int CheckFailure;
+const CheckFailure CF_NONE        = 0;  // 未发现矛盾
+const CheckFailure CF_DUPLICATE   = 1;  // 区域内出现重复的已知数值
+const CheckFailure CF_EMPTY_CELL  = 2;  // 方格没有候选数
+const CheckFailure CF_NO_POSITION = 3;  // 数字在区域内无处可放
+const CheckFailure CF_PIGEONHOLE  = 4;  // 两个数字在区域内只能放在同一方格中
+
 class ShuduSolver {
  public:
   typedef set<int> NumSet;
   typedef pair<int, int> Coor;
   typedef set<Coor> CoorSet;
 
+  // 推导和搜索的配置，默认值取自命令行参数。
+  // 分级、出题等需要在同一进程内切换规则组合的场合，通过SetConfig为每个
+  // 求解器单独设置，而不必修改全局参数。
+  struct Config {
+    bool disableNaked, disableHidden, disableLines, disableFinned;
+    bool disableWing, disableChain, disableAls, disableForcing;
+    bool disableShorten;
+    bool assumeUnique;
+    int levelNaked, levelHidden, levelLines, levelWing, levelChain, levelAls;
+    int budgetChain, budgetForcing;
+    int maxSolution;
+    bool randomBranch;
+    RestartSchedule restart;
+    int restartNodes;
+    BranchPolicy branch;
+    bool branchLcv;
+    bool gridTable;
+    bool quiet;     // 不输出任何推导、猜测信息和棋局
+
+    Config()
+        : disableNaked(g_disable_naked_deduce),
+          disableHidden(g_disable_hidden_deduce),
+          disableLines(g_disable_lines_deduce),
+          disableFinned(g_disable_finned_deduce),
+          disableWing(g_disable_wing_deduce),
+          disableChain(g_disable_chain_deduce),
+          disableAls(g_disable_als_deduce),
+          disableForcing(g_disable_forcing_deduce),
+          disableShorten(g_disable_shorten_deduce),
+          assumeUnique(g_assume_unique),
+          levelNaked(g_level_naked_deduce),
+          levelHidden(g_level_hidden_deduce),
+          levelLines(g_level_lines_deduce),
+          levelWing(g_level_wing_deduce),
+          levelChain(g_level_chain_deduce),
+          levelAls(g_level_als_deduce),
+          budgetChain(g_budget_chain_deduce),
+          budgetForcing(g_budget_forcing_deduce),
+          maxSolution(g_max_solution),
+          randomBranch(g_random_branch || !g_restart.empty()),
+          restart(ParseRestart(g_restart)),
+          restartNodes(max(g_restart_nodes, 1)),
+          branch(ParseBranch(g_branch)),
+          branchLcv(g_branch_lcv),
+          gridTable(g_grid_table),
+          quiet(false) { }
+  };
+
   // 打印棋局（普通模式），将打印出各方格所有的候选数。
   void PrintBoard(const char *label=NULL) const {
     if (label != NULL && *label != '\0') cout << label << endl;
-    for (int xx = 1; xx <= SIZE; ++xx) {
-      for (int yy = 1; yy <= SIZE; ++yy) {
-        const NumSet &possible = board_[xx-1][yy-1];
-        if (mark_[xx-1][yy-1]) {
-          cout << Num2Char(*possible.begin());
+    for (int xx = 1; xx <= ROWS; ++xx) {
+      for (int yy = 1; yy <= COLS; ++yy) {
+        const ValMask &possible = board_[xx-1][yy-1];
+        if (!IsActive(xx-1, yy-1)) {
+          cout << '.';
+        } else if (mark_[xx-1][yy-1]) {
+          cout << Num2Char(MaskToVal(possible));
         } else {
           cout << '[';
-          for (NumSet::const_iterator it = possible.begin();
-               it != possible.end(); ++it)
-            cout << Num2Char(*it);
+          bool first = true;
+          for (int val = 1; val <= SIZE; ++val) {
+            if (!HasVal(possible, val)) continue;
+            cout << (first || SIZE <= MAX_CHAR_VAL ? "" : ",")
+                 << Num2Char(val);
+            first = false;
+          }
           cout << ']';
         }
-        if (yy < SIZE)
+        if (yy < COLS)
           cout << ((yy % BLOCKY == 0) ? "   " : " ");
       }
-      cout << ((xx % BLOCKX == 0 && xx < SIZE) ? "\n\n" : "\n");
+      cout << ((xx % BLOCKX == 0 && xx < ROWS) ? "\n\n" : "\n");
     }
     cout << endl;
   }
@@ -146,18 +720,18 @@ class ShuduSolver {
     if (label != NULL && *label != '\0') cout << label << endl;
     // cout << "┏";
     cout << "+";
-    for (int yy = 1; yy <= SIZE; ++yy)
-    //   cout << "━" << (yy == SIZE ? "┓" : (yy % BLOCKY == 0 ? "┳" : "┯"));
-      cout << "--" << (yy == SIZE ? "-+" : (yy % BLOCKY == 0 ? "-+" : "-+"));
+    for (int yy = 1; yy <= COLS; ++yy)
+    //   cout << "━" << (yy == COLS ? "┓" : (yy % BLOCKY == 0 ? "┳" : "┯"));
+      cout << "--" << (yy == COLS ? "-+" : (yy % BLOCKY == 0 ? "-+" : "-+"));
     cout << endl;
-    for (int xx = 1; xx <= SIZE; ++xx) {
+    for (int xx = 1; xx <= ROWS; ++xx) {
     //   cout << "┃";
       cout << "|";
-      for (int yy = 1; yy <= SIZE; ++yy) {
-        const NumSet &possible = board_[xx-1][yy-1];
+      for (int yy = 1; yy <= COLS; ++yy) {
+        const ValMask &possible = board_[xx-1][yy-1];
         cout.width(2);
-        if (mark_[xx-1][yy-1]) {
-          cout << Num2Char(*possible.begin())
+        if (mark_[xx-1][yy-1] && IsActive(xx-1, yy-1)) {
+          cout << Num2Char(MaskToVal(possible))
             //    << (yy % BLOCKY == 0 ? "┃" : "│");
                << (yy % BLOCKY == 0 ? " |" : " :");
         } else {
@@ -167,19 +741,19 @@ class ShuduSolver {
         }
       }
       cout << endl;
-      if (xx < SIZE) {
+      if (xx < ROWS) {
         // cout << (xx % BLOCKX == 0 ? "┣" : "┠");
         cout << (xx % BLOCKX == 0 ? "+" : "+");
-        for (int yy = 1; yy <= SIZE; ++yy)
+        for (int yy = 1; yy <= COLS; ++yy)
           if (xx % BLOCKX == 0) {
-            // cout << "━" << (yy == SIZE ? "┫" :
+            // cout << "━" << (yy == COLS ? "┫" :
             //      (yy % BLOCKY == 0 ? "╋" : "┿"));
-            cout << "--" << (yy == SIZE ? "-+" :
+            cout << "--" << (yy == COLS ? "-+" :
                  (yy % BLOCKY == 0 ? "-+" : "-+"));
           } else {
-            // cout << "─" << (yy == SIZE ? "┨" :
+            // cout << "─" << (yy == COLS ? "┨" :
             //      (yy % BLOCKY == 0 ? "╂" : "┼"));
-            cout << " -" << (yy == SIZE ? " +" :
+            cout << " -" << (yy == COLS ? " +" :
                  (yy % BLOCKY == 0 ? " +" : " +"));
           }
         cout << endl;
@@ -187,9 +761,9 @@ class ShuduSolver {
     }
     // cout << "┗";
     cout << "+";
-    for (int yy = 1; yy <= SIZE; ++yy)
-    //   cout << "━" << (yy == SIZE ? "┛" : (yy % BLOCKY == 0 ? "┻" : "┷"));
-      cout << "--" << (yy == SIZE ? "-+" : (yy % BLOCKY == 0 ? "-+" : "-+"));
+    for (int yy = 1; yy <= COLS; ++yy)
+    //   cout << "━" << (yy == COLS ? "┛" : (yy % BLOCKY == 0 ? "┻" : "┷"));
+      cout << "--" << (yy == COLS ? "-+" : (yy % BLOCKY == 0 ? "-+" : "-+"));
     cout << "\n" << endl;
   }
 
@@ -199,24 +773,25 @@ class ShuduSolver {
     if (label != NULL && *label != '\0') cout << label << endl;
     // cout << "┏";
     cout << "+";
-    for (int yy = 1; yy <= SIZE; ++yy) {
+    for (int yy = 1; yy <= COLS; ++yy) {
     //   for (int yyy = 0; yyy < BLOCKY; ++yyy) cout << "━";
       for (int yyy = 0; yyy < BLOCKY; ++yyy) cout << "--";
-    //   cout << (yy == SIZE ? "┓" : (yy % BLOCKY == 0 ? "┳" : "┯"));
-      cout << (yy == SIZE ? "-+" : (yy % BLOCKY == 0 ? "-+" : "-+"));
+    //   cout << (yy == COLS ? "┓" : (yy % BLOCKY == 0 ? "┳" : "┯"));
+      cout << (yy == COLS ? "-+" : (yy % BLOCKY == 0 ? "-+" : "-+"));
     }
     cout << endl;
-    for (int xx = 1; xx <= SIZE; ++xx) {
+    for (int xx = 1; xx <= ROWS; ++xx) {
       for (int xxx = 0; xxx < BLOCKX; ++xxx) {
         // cout << "┃";
         cout << "|";
-        for (int yy = 1; yy <= SIZE; ++yy) {
-          const NumSet &possible = board_[xx-1][yy-1];
-          bool marked = mark_[xx-1][yy-1];
+        for (int yy = 1; yy <= COLS; ++yy) {
+          const ValMask &possible = board_[xx-1][yy-1];
+          // 不参与求解的方格留空。
+          bool marked = mark_[xx-1][yy-1] && IsActive(xx-1, yy-1);
           for (int yyy = 0; yyy < BLOCKY; ++yyy) {
             int val = xxx * BLOCKY + yyy + 1;
             cout.width(2);
-            if (possible.find(val) != possible.end()) {
+            if (HasVal(possible, val)) {
               cout << Num2Char(val);
             } else {
             //   cout << (marked ? "■" : "");
@@ -228,23 +803,23 @@ class ShuduSolver {
         }
         cout << endl;
       }
-      if (xx < SIZE) {
+      if (xx < ROWS) {
         // cout << (xx % BLOCKX == 0 ? "┣" : "┠");
         cout << (xx % BLOCKX == 0 ? "+" : "+");
-        for (int yy = 1; yy <= SIZE; ++yy)
+        for (int yy = 1; yy <= COLS; ++yy)
           if (xx % BLOCKX == 0) {
             // for (int yyy = 0; yyy < BLOCKY; ++yyy) cout << "━";
             for (int yyy = 0; yyy < BLOCKY; ++yyy) cout << "--";
-            // cout << (yy == SIZE ? "┫" :
+            // cout << (yy == COLS ? "┫" :
             //      (yy % BLOCKY == 0 ? "╋" : "┿"));
-            cout << (yy == SIZE ? "-+" :
+            cout << (yy == COLS ? "-+" :
                  (yy % BLOCKY == 0 ? "-+" : "-+"));
           } else {
             // for (int yyy = 0; yyy < BLOCKY; ++yyy) cout << "─";
             for (int yyy = 0; yyy < BLOCKY; ++yyy) cout << " -";
-            // cout << (yy == SIZE ? "┨" :
+            // cout << (yy == COLS ? "┨" :
             //      (yy % BLOCKY == 0 ? "╂" : "┼"));
-            cout << (yy == SIZE ? " +" :
+            cout << (yy == COLS ? " +" :
                  (yy % BLOCKY == 0 ? " +" : " +"));
           }
         cout << endl;
@@ -252,44 +827,285 @@ class ShuduSolver {
     }
     // cout << "┗";
     cout << "+";
-    for (int yy = 1; yy <= SIZE; ++yy) {
+    for (int yy = 1; yy <= COLS; ++yy) {
     //   for (int yyy = 0; yyy < BLOCKY; ++yyy) cout << "━";
       for (int yyy = 0; yyy < BLOCKY; ++yyy) cout << "--";
-    //   cout << (yy == SIZE ? "┛" : (yy % BLOCKY == 0 ? "┻" : "┷"));
-      cout << (yy == SIZE ? "-+" : (yy % BLOCKY == 0 ? "-+" : "-+"));
+    //   cout << (yy == COLS ? "┛" : (yy % BLOCKY == 0 ? "┻" : "┷"));
+      cout << (yy == COLS ? "-+" : (yy % BLOCKY == 0 ? "-+" : "-+"));
     }
     cout << "\n" << endl;
   }
 
-  ShuduSolver(int blockx, int blocky)
+  // samurai为true时为武士数独：五个子棋盘呈X形排列，四角的子棋盘各与中央的
+  // 子棋盘重叠一个宫格，不属于任何子棋盘的方格不参与求解。
+  ShuduSolver(int blockx, int blocky, bool samurai=false)
       : BLOCKX(blockx), BLOCKY(blocky), SIZE(BLOCKX * BLOCKY),
-      board_(SIZE, vector<NumSet>(SIZE)),
-      mark_(SIZE, vector<bool>(SIZE, false)),
-      solutionCnt_(0) {
-    for (int xx = 0; xx < SIZE; ++xx)
-      for (int yy = 0; yy < SIZE; ++yy)
-        for (int val = 1; val <= SIZE; ++val)
-          board_[xx][yy].insert(val);
+      ROWS(samurai ? 3 * SIZE - 2 * BLOCKX : SIZE),
+      COLS(samurai ? 3 * SIZE - 2 * BLOCKY : SIZE),
+      board_(ROWS, vector<ValMask>(COLS, 0)),
+      mark_(ROWS, vector<bool>(COLS, false)),
+      solutionCnt_(0), guessCnt_(0), restartCnt_(0), nodeLimit_(0),
+      aborted_(false), random_(NULL), variant_(ParseVariant(g_variant)) {
+    fill(ruleCnt_, ruleCnt_ + DR_END, 0);
+    fill(uniqueCnt_, uniqueCnt_ + UR_TYPES + 1, 0);
+    grids_.push_back(Coor(0, 0));
+    if (samurai) {
+      int dx = SIZE - BLOCKX, dy = SIZE - BLOCKY;
+      grids_.push_back(Coor(0, 2 * dy));
+      grids_.push_back(Coor(dx, dy));
+      grids_.push_back(Coor(2 * dx, 0));
+      grids_.push_back(Coor(2 * dx, 2 * dy));
+    }
+    active_.assign(ROWS * COLS, false);
+    for (vector<Coor>::const_iterator itg = grids_.begin();
+         itg != grids_.end(); ++itg)
+      for (int xx = itg->first; xx < itg->first + SIZE; ++xx)
+        for (int yy = itg->second; yy < itg->second + SIZE; ++yy)
+          active_[xx * COLS + yy] = true;
+    // 不参与求解的方格没有候选数，并且总是标记为已确定。
+    for (int xx = 0; xx < ROWS; ++xx) {
+      for (int yy = 0; yy < COLS; ++yy) {
+        mark_[xx][yy] = !IsActive(xx, yy);
+        if (IsActive(xx, yy)) board_[xx][yy] = FullMask(SIZE);
+      }
+    }
+    DefaultRegions(region_);
+    regular_ = true;
+    cellCage_.assign(ROWS * COLS, -1);
+    BuildAreas();
+  }
+
+  // 设置杀手数独的笼子：cageOf按行优先的顺序给出每个方格所属笼子的序号，
+  // -1表示不属于任何笼子；sums[i]为第i个笼子内各数值之和。同一笼子内的数值
+  // 互不相同，笼子互不重叠，但不必覆盖整个棋盘。须在LoadGivens之前调用。
+  // 返回false表示笼子不合法，此时笼子不变。
+  bool SetCages(const vector<int> &cageOf, const vector<int> &sums) {
+    if ((int)cageOf.size() != ROWS * COLS) return false;
+    vector<Cage> cages(sums.size());
+    for (int ii = 0; ii < ROWS * COLS; ++ii) {
+      if (cageOf[ii] < -1 || cageOf[ii] >= (int)sums.size()) return false;
+      if (cageOf[ii] < 0) continue;
+      if (!active_[ii]) return false;
+      cages[cageOf[ii]].cells.push_back(Coor(ii / COLS, ii % COLS));
+    }
+    int maxCells = 0;
+    for (size_t ii = 0; ii < cages.size(); ++ii) {
+      cages[ii].sum = sums[ii];
+      int cnt = cages[ii].cells.size();
+      if (cnt == 0 || cnt > SIZE) return false;
+      maxCells = max(maxCells, cnt);
+    }
+    BuildCageCombos(maxCells);
+    for (size_t ii = 0; ii < cages.size(); ++ii) {
+      const Cage &cage = cages[ii];
+      if (cage.sum < 0 || cage.sum >= (int)cageCombos_[0].size() ||
+          cageCombos_[cage.cells.size()][cage.sum].empty())
+        return false;
+    }
+
+    cages_ = cages;
+    cellCage_ = cageOf;
+    IndexAreas();
+    return true;
+  }
+
+  // 设置不规则的宫格（锯齿数独）：regions按行优先的顺序给出每个方格所属宫格
+  // 的序号（0～SIZE-1），每个宫格须恰好有SIZE个方格。须在LoadGivens之前
+  // 调用，不适用于武士数独。返回false表示regions不合法，此时宫格不变。
+  bool SetRegions(const vector<int> &regions) {
+    if (grids_.size() != 1) return false;
+    if ((int)regions.size() != ROWS * COLS) return false;
+    vector<int> cnt(SIZE, 0);
+    for (int ii = 0; ii < ROWS * COLS; ++ii) {
+      if (regions[ii] < 0 || regions[ii] >= SIZE) return false;
+      ++cnt[regions[ii]];
+    }
+    for (int ii = 0; ii < SIZE; ++ii)
+      if (cnt[ii] != SIZE) return false;
+
+    vector<int> standard;
+    DefaultRegions(standard);
+    region_ = regions;
+    regular_ = (regions == standard);
+    BuildAreas();
+    return true;
+  }
+
+  // 设置变型数独的附加区域，须在LoadGivens之前调用。
+  void SetVariant(Variant variant) {
+    variant_ = variant;
+    BuildAreas();
+  }
+
+  int GetRows() const {
+    return ROWS;
+  }
+
+  int GetCols() const {
+    return COLS;
   }
 
   int GetSolutionCnt() const {
     return solutionCnt_;
   }
 
+  int GetGuessCnt() const {
+    return guessCnt_;
+  }
+
+  // 只关心解而不关心推导过程时使用的配置：只保留代价最低的唯一候选数法、
+  // 隐性唯一候选数法和区块删减法，其余规则在搜索中得不偿失。
+  static Config SearchConfig(const Config &base) {
+    Config config = base;
+    config.levelNaked = config.levelHidden = 1;
+    config.disableLines = config.disableFinned = true;
+    config.disableWing = config.disableChain = true;
+    config.disableAls = config.disableForcing = true;
+    config.assumeUnique = false;
+    return config;
+  }
+
+  const Config &GetConfig() const {
+    return config_;
+  }
+
+  void SetConfig(const Config &config) {
+    config_ = config;
+  }
+
+  // 设置搜索时使用的随机数生成器，NULL表示按从小到大的顺序尝试候选数。
+  void SetRandom(Random *random) {
+    random_ = random;
+  }
+
+  // 按行优先的顺序取出每个方格的候选数掩码，不参与求解的方格为0。
+  void GetPencil(vector<ValMask> &masks) const {
+    masks.assign(ROWS * COLS, 0);
+    for (int xx = 0; xx < ROWS; ++xx)
+      for (int yy = 0; yy < COLS; ++yy)
+        masks[xx * COLS + yy] = board_[xx][yy];
+  }
+
+  // 按行优先的顺序取出每个方格的数值，未确定和不参与求解的方格为NO_VAL。
+  void GetValues(vector<int> &values) const {
+    values.assign(ROWS * COLS, NO_VAL);
+    for (int xx = 0; xx < ROWS; ++xx)
+      for (int yy = 0; yy < COLS; ++yy)
+        if (mark_[xx][yy] && IsActive(xx, yy))
+          values[xx * COLS + yy] = MaskToVal(board_[xx][yy]);
+  }
+
+  // 在已经通过LoadGivens设置好的棋局上随机取样一个解，记录在solution中，
+  // 返回false表示无解。
+  // 每次假设时，先对各个候选数分别计数其后的解（至多countLimit个）：
+  // 若都没有达到上限，则按解的数目加权随机选择，这一步是精确均匀的；否则在
+  // 有解的候选数中等概率选择，只是近似均匀。因此解的总数少于countLimit时
+  // 取样是精确均匀的；近乎空白的棋盘上，只有后面几步是精确的。
+  bool SampleSolution(Random &random, int countLimit,
+                      vector<int> &solution) {
+    if (!Deduce()) return false;
+    int x, y;
+    while (FindGuessCell(x, y)) {
+      vector<int> vals;
+      for (int val = 1; val <= SIZE; ++val)
+        if (HasVal(board_[x][y], val)) vals.push_back(val);
+      vector<int> counts(vals.size(), 0);
+      int total = 0;
+      bool exact = true;
+      for (int ii = 0; ii < (int)vals.size(); ++ii) {
+        counts[ii] = CountBranch(x, y, vals[ii], countLimit);
+        total += counts[ii];
+        if (counts[ii] >= countLimit) exact = false;
+      }
+      if (total == 0) return false;
+
+      int pick = 0;
+      if (exact) {
+        int rest = random.Uniform(total);
+        while (rest >= counts[pick]) rest -= counts[pick++];
+      } else {
+        vector<int> feasible;
+        for (int ii = 0; ii < (int)vals.size(); ++ii)
+          if (counts[ii] > 0) feasible.push_back(ii);
+        pick = feasible[random.Uniform(feasible.size())];
+      }
+      if (!SetCellAndDeduce(x, y, vals[pick])) return false;
+    }
+    if (!IsOK()) return false;
+    GetValues(solution);
+    return true;
+  }
+
+  // 计数已经推导过的当前棋局的解，至多limit个（达到limit时返回limit），
+  // 不打印解。未确定的方格可能分成互不相关（不同在任何一个区域内）的几组，
+  // 各组的解可以任意组合，因此分别计数后相乘，而不是枚举它们的组合。
+  long long CountSolutions(long long limit) {
+    GridTable::Bits bits;
+    if (MatchTable(bits)) return min<long long>(GridTable::Count(bits), limit);
+    vector<int> cells;
+    for (int ii = 0; ii < ROWS * COLS; ++ii)
+      if (!mark_[ii / COLS][ii % COLS]) cells.push_back(ii);
+    return CountComponents(cells, limit);
+  }
+
+  // 用完整棋局表匹配当前棋局的候选数，结果为所有解的位集。
+  // 返回false表示没有可用的表。
+  bool MatchTable(GridTable::Bits &bits) const {
+    const GridTable *table = GridTable::Find(BLOCKX, BLOCKY);
+    if (!config_.gridTable || table == NULL || !regular_ ||
+        grids_.size() != 1 || variant_ != VT_NONE || !cages_.empty())
+      return false;
+    vector<ValMask> allowed(ROWS * COLS);
+    for (int xx = 0; xx < ROWS; ++xx)
+      for (int yy = 0; yy < COLS; ++yy)
+        allowed[xx * COLS + yy] = board_[xx][yy];
+    table->Match(allowed, bits);
+    return true;
+  }
+
+  // 在已经通过LoadGivens设置好的棋局上，搜索方格(x, y)的数值不是val的一个
+  // 解，用于检查删除一个已知数之后解是否仍然唯一。
+  // 找到时返回true，并将这个解记录在solution中。
+  bool FindOtherSolution(int x, int y, int val, vector<int> &solution) {
+    solutionCnt_ = 0;
+    if (RemovePossible(x, y, val) == S_FAILED || !Deduce()) return false;
+    int maxSolution = config_.maxSolution;
+    config_.maxSolution = 1;
+    SolveDoubt();
+    config_.maxSolution = maxSolution;
+    if (solutionCnt_ == 0) return false;
+    GetValues(solution);
+    return true;
+  }
+
+  // 打印各规则的有效推导次数（包括猜测过程中的推导）。
+  // 唯一性规则依赖于题目有唯一解的假设，单独列出。
+  void ShowStats() const {
+    cout << "推导统计：" << endl;
+    for (DeduceRule rule = DR_BEGIN; rule < DR_END; ++rule) {
+      if (rule == DR_UNIQUE) continue;
+      cout << "  " << DEDUCE_RULE_STR[rule] << "：" << ruleCnt_[rule] << endl;
+    }
+    cout << "唯一性规则（假设唯一解）：" << endl;
+    for (int type = 0; type < UR_TYPES; ++type)
+      cout << "  唯一矩形类型" << type + 1 << "：" << uniqueCnt_[type] << endl;
+    cout << "  BUG+1：" << uniqueCnt_[UR_TYPES] << endl;
+    cout << "搜索：假设" << guessCnt_ << "次，重启" << restartCnt_ << "次。"
+         << endl;
+  }
+
   // 设置方格(x, y)的数值为val，操作成功后，与此方格同行、列、宫格的其他方格内
   // 的候选数val将被删除。
   Status SetCell(int x, int y, int val) {
     if (val == NO_VAL) return S_FINISHED;
-    if (x < 0 || x >= SIZE || y < 0 || y >= SIZE || val < 1 || val > SIZE) {
+    if (x < 0 || x >= ROWS || y < 0 || y >= COLS || val < 1 || val > SIZE) {
       cout << "错误：不存在的方格(" << x << ", " << y
            << ")或错误的数值" << Num2Char(val) << "。" << endl;
       return S_FAILED;
     }
 
-    const NumSet &possible = board_[x][y];
     if (mark_[x][y]) {
-      if (possible.size() == 1 && possible.find(val) != possible.end())
-        return S_FINISHED;
+      if (board_[x][y] == ValBit(val)) return S_FINISHED;
       cout << "错误：方格(" << x << ", " << y
            << "无法被设置为" << Num2Char(val)
            << "，请检查此方格的候选数。" << endl;
@@ -298,9 +1114,119 @@ class ShuduSolver {
 
     CoorSet coors;
     coors.insert(Coor(x, y));
-    NumSet vals;
-    vals.insert(val);
-    return SetPossible(coors, vals);
+    return SetPossible(coors, ValBit(val));
+  }
+
+  // 一次性设置全部初始数值，givens按行优先的顺序给出每个方格的数值，
+  // NO_VAL表示空方格，不参与求解的方格的数值被忽略。
+  // 先用位掩码扫描一遍，得到每个区域内已知数值的集合并检查重复；
+  // 再将每个空方格的候选数直接设为全部数值去掉其所在各区域已知数值后
+  // 的结果。最后将所有区域加入待处理区域列表，留给推导过程处理。
+  Status LoadGivens(const vector<int> &givens) {
+    if ((int)givens.size() != ROWS * COLS) {
+      cout << "错误：初始数据应包含" << ROWS * COLS << "个方格，实际为"
+           << givens.size() << "个。" << endl;
+      return S_FAILED;
+    }
+
+    vector<ValMask> areaMask(allAreas_.size(), 0);
+    for (int xx = 0; xx < ROWS; ++xx) {
+      for (int yy = 0; yy < COLS; ++yy) {
+        int val = givens[xx * COLS + yy];
+        if (val == NO_VAL || !IsActive(xx, yy)) continue;
+        if (val < 1 || val > SIZE) {
+          if (!config_.quiet)
+            cout << "错误：方格(" << xx+1 << ", " << yy+1
+                 << ")的数值" << Num2Char(val) << "超出范围。" << endl;
+          return S_FAILED;
+        }
+        ValMask bit = ValBit(val);
+        if ((AreasMask(xx, yy, areaMask) & bit) != 0) {
+          if (!config_.quiet)
+            cout << "错误：方格(" << xx+1 << ", " << yy+1
+                 << ")的数值" << Num2Char(val)
+                 << "与同行、列或宫格内的已知数值重复。" << endl;
+          return S_FAILED;
+        }
+        const vector<int> &areas = cellAreas_[xx * COLS + yy];
+        for (vector<int>::const_iterator ita = areas.begin();
+             ita != areas.end(); ++ita)
+          areaMask[*ita] |= bit;
+      }
+    }
+
+    const ValMask full = FullMask(SIZE);
+    trail_.clear();
+    solutionCnt_ = 0;
+    for (int xx = 0; xx < ROWS; ++xx) {
+      for (int yy = 0; yy < COLS; ++yy) {
+        if (!IsActive(xx, yy)) continue;
+        int val = givens[xx * COLS + yy];
+        ValMask &possible = board_[xx][yy];
+        mark_[xx][yy] = (val != NO_VAL);
+        if (val != NO_VAL) {
+          possible = ValBit(val);
+          continue;
+        }
+        possible = full & ~AreasMask(xx, yy, areaMask);
+        if (possible == 0) {
+          if (!config_.quiet)
+            cout << "错误：方格(" << xx+1 << ", " << yy+1
+                 << ")已经没有可以填入的数值。" << endl;
+          return S_FAILED;
+        }
+      }
+    }
+
+    PushAllAreas();
+    return S_NORMAL;
+  }
+
+  // 一次性设置全部候选数，用于从此前推导得到的候选数继续求解。masks按行优先
+  // 的顺序给出每个方格的候选数掩码，只有一个候选数的方格视为已确定，不参与
+  // 求解的方格的掩码被忽略。
+  // 与LoadGivens不同，这里不把所有区域加入待处理区域列表，已经做过的推导不会
+  // 重做：只有已确定的数值仍出现在同区域其他方格的候选数中时，才删除这些
+  // 候选数并将这些方格所在的区域加入列表。笼子的检查代价很低，总是加入列表。
+  Status LoadPencil(const vector<ValMask> &masks) {
+    if ((int)masks.size() != ROWS * COLS) return S_FAILED;
+    const ValMask full = FullMask(SIZE);
+    trail_.clear();
+    areaStack_.clear();
+    solutionCnt_ = 0;
+    for (int xx = 0; xx < ROWS; ++xx) {
+      for (int yy = 0; yy < COLS; ++yy) {
+        if (!IsActive(xx, yy)) continue;
+        ValMask mask = masks[xx * COLS + yy] & full;
+        if (mask == 0) return S_FAILED;
+        board_[xx][yy] = mask;
+        mark_[xx][yy] = (BitCount(mask) == 1);
+      }
+    }
+
+    for (AreaVec::const_iterator ita = allAreas_.begin();
+         ita != allAreas_.end(); ++ita) {
+      ValMask placed = 0;
+      for (vector<Coor>::const_iterator itc = ita->cells.begin();
+           itc != ita->cells.end(); ++itc) {
+        if (!mark_[itc->first][itc->second]) continue;
+        ValMask bit = board_[itc->first][itc->second];
+        if ((placed & bit) != 0) return S_FAILED;
+        placed |= bit;
+      }
+      for (vector<Coor>::const_iterator itc = ita->cells.begin();
+           itc != ita->cells.end(); ++itc) {
+        int xx = itc->first, yy = itc->second;
+        if (mark_[xx][yy] || (board_[xx][yy] & placed) == 0) continue;
+        ValMask &possible = board_[xx][yy];
+        possible &= ~placed;
+        if (possible == 0) return S_FAILED;
+        PushAreas(xx, yy);
+      }
+    }
+    for (int ii = 0; ii < (int)cages_.size(); ++ii)
+      areaStack_.insert(allAreas_.size() + ii);
+    return S_NORMAL;
   }
 
   // 对当前棋盘进行推导，直到推导结束或出现错误。
@@ -314,174 +1240,723 @@ class ShuduSolver {
 
   // 处理不确定的棋局，搜索可行解。
   // 返回值通常均为false。
-  // 此函数在发现棋局无解或找到最多g_max_solution个解后返回。
+  // 此函数在发现棋局无解或找到最多config_.maxSolution个解后返回。
   // 参数depth表示递归深度。
   bool SolveDoubt(int depth=0) {
-    // 在棋盘中寻找第一个出现的候选数个数最少的方格。
-    int x = -1, y = -1, minlen = SIZE + 1;
-    for (int xx = 0; xx < SIZE; ++xx) {
-      for (int yy = 0; yy < SIZE; ++yy) {
-        int len = board_[xx][yy].size();
-        if (!mark_[xx][yy] && len < minlen) {
-          x = xx;
-          y = yy;
-          minlen = len;
-        }
-      }
-    }
-    if (x < 0 || y < 0 || minlen > SIZE) {
+    vector<vector<int> > parts(1);
+    for (int ii = 0; ii < ROWS * COLS; ++ii)
+      if (!mark_[ii / COLS][ii % COLS]) parts[0].push_back(ii);
+    return SolveParts(parts, depth);
+  }
+
+  // 依次搜索parts中各组方格，parts.back()为当前组，各组之间互不相关（见
+  // SplitComponents）。当前组完全确定之后才搜索下一组，于是当前组的每个解
+  // 都能与其他组的解组合成整个棋局的解。返回时parts恢复原状。
+  bool SolveParts(vector<vector<int> > &parts, int depth) {
+    if (parts.empty()) {
       if (!IsOK()) return false;
-      PrintBoardMark("得到一个可行解：");
+      if (!config_.quiet) PrintBoardMark("得到一个可行解：");
       ++solutionCnt_;
       return true;
     }
+    vector<int> current;
+    current.swap(parts.back());
+    parts.pop_back();
+    bool res = SolvePart(current, parts, depth);
+    parts.push_back(vector<int>());
+    parts.back().swap(current);
+    return res;
+  }
 
-    // 备份当前棋局以便回溯。
-    Board board = board_;
-    Mark mark = mark_;
-
-    // 遍历此方格的所有候选数，搜索可行解。
-    const NumSet &possible = board[x][y];
-    for (NumSet::const_iterator itp = possible.begin();
-         itp != possible.end(); ++itp) {
-      cout.width(depth);
-      cout << "" << "假设(" << x+1 << ", " << y+1 << ")是"
-           << Num2Char(*itp) << "：" << endl;
-      if (SetCellAndDeduce(x, y, *itp) && SolveDoubt(depth+1)) {
-        if (solutionCnt_ >= g_max_solution) return true;
-      }
-      board_ = board;
-      mark_ = mark;
+  // 搜索当前组current（已经从parts中取出）。上一次假设之后current中的
+  // 未确定方格可能分成几组：第一组以外的各组先试探是否有解，某一组无解时
+  // 立即返回，而不是在其他组的每一种填法下重新发现它无解；然后各组压入
+  // parts，只在第一组内假设。
+  bool SolvePart(const vector<int> &current, vector<vector<int> > &parts,
+                 int depth) {
+    vector<vector<int> > components;
+    SplitComponents(current, components);
+    if (components.empty()) return SolveParts(parts, depth);
+    for (int ii = 1; ii < (int)components.size(); ++ii)
+      if (!ProbeComponent(components[ii])) return false;
+    size_t partCnt = parts.size();
+    for (int ii = components.size() - 1; ii >= 0; --ii) {
+      parts.push_back(vector<int>());
+      parts.back().swap(components[ii]);
     }
-    return false;
-   }
 
-  // 判断是否已经得到解。
-  bool IsOK() const {
-    for (int xx = 0; xx < SIZE; ++xx) {
-      if (!IsOK(xx, xx, AT_ROW)) return false;
-      if (!IsOK(xx, xx, AT_COL)) return false;
-    }
-    for (int xx = 0; xx < SIZE; xx += BLOCKX) {
-      for (int yy = 0; yy < SIZE; yy += BLOCKY) {
-        if (!IsOK(xx, yy, AT_BLOCK)) return false;
+    BranchVec branches;
+    FindBranches(branches, &parts.back());
+
+    // 记下修改记录的位置以便回溯。
+    size_t trailPos = trail_.size();
+
+    // 遍历所有分支，搜索可行解。
+    bool res = false;
+    for (BranchVec::const_iterator itb = branches.begin();
+         itb != branches.end() && !ReachNodeLimit(); ++itb) {
+      ++guessCnt_;
+      int x = itb->first.first, y = itb->first.second;
+      if (!config_.quiet) {
+        cout.width(depth);
+        cout << "" << "假设(" << x+1 << ", " << y+1 << ")是"
+             << Num2Char(itb->second) << "：" << endl;
+      }
+      if (SetCellAndDeduce(x, y, itb->second) && SolveParts(parts, depth+1)) {
+        if (solutionCnt_ >= config_.maxSolution) {
+          res = true;
+          break;
+        }
       }
+      Undo(trailPos);
+      if (aborted_) break;
     }
-    return true;
+    parts.resize(partCnt);
+    return res;
   }
 
- private:
-  typedef vector<bool> BoolVec;
-  typedef vector<vector<NumSet> > Board;
-  typedef vector<vector<bool> > Mark;
+  // 假设次数是否已经达到nodeLimit_，达到时设置aborted_。
+  bool ReachNodeLimit() {
+    if (nodeLimit_ > 0 && guessCnt_ >= nodeLimit_) aborted_ = true;
+    return aborted_;
+  }
 
-  // 区域范围，指一行、一列或一个宫格。
-  struct Area {
-    AreaType at;  // 区域类型
-    Coor lt;      // 区域扫描起点坐标
-    Coor rb;      // 区域扫描终点坐标
+  // 搜索可行解。只需要一个解、配置了重启策略并且设置了随机数生成器时，按
+  // 策略限制每一轮搜索的假设次数，超过限制就回到搜索开始时的棋局重新随机
+  // 搜索，以避开随机搜索偶尔陷入的超长搜索。限制会无限增长，因此搜索仍然
+  // 是完备的。
+  bool Search() {
+    if (config_.restart == RS_NONE || config_.maxSolution != 1 ||
+        random_ == NULL)
+      return SolveDoubt();
 
-    Area(AreaType t=AT_END) : at(t) { }
-  };
-  struct LTArea : public binary_function<const Area&, const Area&, bool> {
-    bool operator()(const Area &area1, const Area &area2) {
-      if (area1.at < area2.at) return true;
-      if (area1.at > area2.at) return false;
-      if (area1.lt.first < area2.lt.first) return true;
-      if (area1.lt.first > area2.lt.first) return false;
-      if (area1.lt.second < area2.lt.second) return true;
-      if (area1.lt.second > area2.lt.second) return false;
-      return false;
+    size_t trailPos = trail_.size();
+    for (int run = 1; ; ++run) {
+      nodeLimit_ = guessCnt_ + RestartLimit(run);
+      aborted_ = false;
+      bool res = SolveDoubt();
+      if (!aborted_) {
+        nodeLimit_ = 0;
+        return res;
+      }
+      Undo(trailPos);
+      ++restartCnt_;
+      if (!config_.quiet) cout << "重启搜索。" << endl;
     }
+  }
+
+  // 难度分级的结果：
+  //  category为PUZZLES.md中的分类：A 只需唯一候选数法；B 需要显式、隐式
+  //  规则；C 需要链列规则；D 需要唯一性、翼类、单数字链、ALS-XZ或强制链等
+  //  关键数规则；X 必须猜测，但只有一个解；Y 有多个解；Z 无解。
+  //  rule和level为用到的最难的规则及其等级，没有用到任何规则时rule为DR_END。
+  //  score为难度分数：各规则的有效推导次数按DEDUCE_RULE_SCORE加权求和，
+  //  猜测时每次假设再加上GUESS_SCORE。
+  struct GradeInfo {
+    char category;
+    DeduceRule rule;
+    int level;
+    int score;
+
+    GradeInfo() : category('Z'), rule(DR_END), level(0), score(0) { }
   };
 
-  // 计算包含由coors指定的所有方格的类型为at的区域范围。
-  // 返回false表示不存在这样的区域。
-  bool CalcArea(const CoorSet &coors, AreaType at, Area &area) const {
-    if (coors.empty()) return false;
-
-    const Coor &coor = *coors.begin();
-    switch (at) {
-      case AT_ROW:
-        area.lt.first = coor.first;
-        area.rb.first = area.lt.first + 1;
-        area.lt.second = 0;
-        area.rb.second = area.lt.second + SIZE;
-        break;
-      case AT_COL:
-        area.lt.first = 0;
-        area.rb.first = area.lt.first + SIZE;
-        area.lt.second = coor.second;
-        area.rb.second = area.lt.second + 1;
-        break;
-      case AT_BLOCK:
-        area.lt.first = (coor.first/BLOCKX) * BLOCKX;
-        area.rb.first = area.lt.first + BLOCKX;
-        area.lt.second = (coor.second/BLOCKY) * BLOCKY;
-        area.rb.second = area.lt.second + BLOCKY;
-        break;
+  // 对已经通过LoadGivens设置好的棋局进行难度分级。
+  // 按代价从低到高逐级启用规则，每一级都在上一级推导停止时的棋局上继续推导，
+  // 而不是从头求解。由于推导的结果与规则的使用顺序无关，第一次完成推导的那
+  // 一级就是所需的最小规则集。所有规则都无法完成推导时，再搜索至多2个解以
+  // 区分X、Y类。分级以当前配置为上限（被禁用的规则不会使用），结束后恢复
+  // 当前配置。
+  void Grade(GradeInfo &info) {
+    info = GradeInfo();
+    const Config base = config_;
+    solutionCnt_ = 0;
+    guessCnt_ = 0;
+    fill(ruleCnt_, ruleCnt_ + DR_END, 0);
+    fill(uniqueCnt_, uniqueCnt_ + UR_TYPES + 1, 0);
+
+    GradeStageVec stages;
+    BuildGradeStages(base, stages);
+    bool failed = false;
+    for (int ii = 0; ii < (int)stages.size(); ++ii) {
+      config_ = StageConfig(base, stages, ii);
+      size_t trailPos = trail_.size();
+      PushAllAreas();
+      failed = !Deduce();
+      if (trail_.size() > trailPos) {
+        info.rule = stages[ii].rule;
+        info.level = stages[ii].level;
+      }
+      if (failed || IsOK()) break;
     }
 
-    area.at = at;
-    for (CoorSet::const_iterator it = coors.begin();
-         it != coors.end(); ++it) {
-      if (it == coors.begin()) continue;
-      if (it->first < area.lt.first || it->first >= area.rb.first ||
-          it->second < area.lt.second || it->second >= area.rb.second)
-        return false;
+    if (failed) {
+      info.category = 'Z';
+    } else if (IsOK()) {
+      switch (info.rule) {
+        case DR_END:
+          info.category = 'A';
+          break;
+        case DR_NAKED:
+          info.category = (info.level == 1) ? 'A' : 'B';
+          break;
+        case DR_HIDDEN:
+          info.category = 'B';
+          break;
+        case DR_LINES:
+        case DR_FINNED:
+          info.category = 'C';
+          break;
+        default:
+          info.category = 'D';
+          break;
+      }
+    } else {
+      // 解的数目与推导规则无关，搜索时只使用代价低的规则。多解的棋局
+      // 搜索树较大，保留各级显式、隐式规则可以明显减少假设次数。
+      config_ = SearchConfig(base);
+      config_.levelNaked = base.levelNaked;
+      config_.levelHidden = base.levelHidden;
+      config_.maxSolution = 2;
+      SolveDoubt();
+      info.category = solutionCnt_ == 0 ? 'Z' : (solutionCnt_ == 1 ? 'X' : 'Y');
     }
 
-    return true;
+    for (DeduceRule rule = DR_BEGIN; rule < DR_END; ++rule)
+      info.score += ruleCnt_[rule] * DEDUCE_RULE_SCORE[rule];
+    info.score += guessCnt_ * GUESS_SCORE;
+    config_ = base;
   }
 
-  // 计算包含方格(x, y)的类型为at的区域范围。
-  Area CalcArea(int x, int y, AreaType at) const {
-    CoorSet coors;
-    coors.insert(Coor(x, y));
-    Area area;
-    CalcArea(coors, at, area);
-    return area;
+  void ShowGradeMsg(const GradeInfo &info) const {
+    cout << info.category << " "
+         << (info.rule == DR_END ? "无" : DEDUCE_RULE_STR[info.rule]) << " "
+         << info.level << " " << info.score << endl;
   }
 
-  // 对当前棋盘进行一次推导。
-  Status DoDeduce(bool guessing) {
-    Status res;
-    do {
-      if (!g_disable_naked_deduce || !g_disable_hidden_deduce) {
-        while (!areaStack_.empty()) {
-          const Area &area = *areaStack_.begin();
-          bool finished = true;
-          if (!g_disable_naked_deduce) {
-            res = NakedDeduce(area, guessing);
-            CHECK_STATUS(res, finished);
-          }
-          if (!g_disable_hidden_deduce) {
-            res = HiddenDeduce(area, guessing);
+  // 预检查的结果，failure为CF_NONE时其他字段无意义。
+  struct CheckInfo {
+    CheckFailure failure;
+    int area;       // 发现矛盾的区域的序号（CF_EMPTY_CELL时无意义）
+    Coor coor;      // 发现矛盾的方格，CF_NO_POSITION时为区域内任一方格
+    int val1;       // 相关的数字
+    int val2;       // 相关的第二个数字（仅用于CF_PIGEONHOLE）
+
+    CheckInfo() : failure(CF_NONE), area(-1), val1(NO_VAL), val2(NO_VAL) { }
+  };
+
+  // 在推导之前对棋局做一次代价很低的矛盾检查，检查内容包括：
+  //  1.同一区域内是否有重复的已确定数值；
+  //  2.是否有方格已经没有候选数；
+  //  3.是否有数字在某区域内无处可放（1级隐式规则的 p < q 情形）；
+  //  4.是否有两个数字在某区域内都只能放在同一个方格中（2级隐式规则的
+  //    p < q 情形）。
+  // 每个区域只需扫描一遍并做位运算，总代价为O(SIZE^2)。
+  // 返回S_FAILED表示发现矛盾，此时info记录了矛盾的具体原因。
+  Status PreCheck(CheckInfo &info) const {
+    info = CheckInfo();
+    for (int xx = 0; xx < ROWS; ++xx) {
+      for (int yy = 0; yy < COLS; ++yy) {
+        if (!IsActive(xx, yy) || board_[xx][yy] != 0) continue;
+        info.failure = CF_EMPTY_CELL;
+        info.coor = Coor(xx, yy);
+        return S_FAILED;
+      }
+    }
+
+    for (AreaVec::const_iterator ita = allAreas_.begin();
+         ita != allAreas_.end(); ++ita)
+      if (!PreCheckArea(*ita, info)) return S_FAILED;
+
+    return S_FINISHED;
+  }
+
+  void ShowCheckMsg(const CheckInfo &info) const {
+    const Coor &coor = info.coor;
+    if (info.failure == CF_EMPTY_CELL) {
+      cout << "方格(" << coor.first+1 << "," << coor.second+1
+           << ")没有任何候选数。" << endl;
+      return;
+    }
+
+    ShowArea(allAreas_[info.area]);
+    switch (info.failure) {
+      case CF_DUPLICATE:
+        cout << "中数字" << Num2Char(info.val1) << "重复出现，位于("
+             << coor.first+1 << "," << coor.second+1 << ")。" << endl;
+        break;
+      case CF_NO_POSITION:
+        cout << "中数字" << Num2Char(info.val1) << "无处可放。" << endl;
+        break;
+      case CF_PIGEONHOLE:
+        cout << "中数字" << Num2Char(info.val1) << ","
+             << Num2Char(info.val2) << "都只能放在("
+             << coor.first+1 << "," << coor.second+1 << ")。" << endl;
+        break;
+    }
+  }
+
+  // 判断是否已经得到解。
+  bool IsOK() const {
+    for (AreaVec::const_iterator ita = allAreas_.begin();
+         ita != allAreas_.end(); ++ita)
+      if (!IsOK(*ita)) return false;
+    for (vector<Cage>::const_iterator itc = cages_.begin();
+         itc != cages_.end(); ++itc)
+      if (!IsOK(*itc)) return false;
+    return true;
+  }
+
+ private:
+  typedef vector<bool> BoolVec;
+  typedef vector<vector<ValMask> > Board;
+  typedef vector<vector<bool> > Mark;
+
+  // 对棋局的一次修改：删除方格coor的候选数中vals包含的数值，vals为0时表示
+  // 将方格coor标记为已确定。回溯时按相反的顺序撤销这些修改。
+  struct TrailEntry {
+    Coor coor;
+    ValMask vals;
+
+    TrailEntry(const Coor &c, const ValMask &v) : coor(c), vals(v) { }
+  };
+
+  // 区域，指一行、一列或一个宫格，宫格可以是不规则的（锯齿数独）。
+  // 区域用方格列表表示，全部区域由BuildAreas生成后只读，其他地方都通过区域
+  // 在allAreas_中的序号引用区域。
+  struct Area {
+    AreaType at;          // 区域类型
+    int id;               // 在allAreas_中的序号
+    vector<Coor> cells;   // 区域内的方格，按行优先的顺序
+    Coor lt;              // 外接矩形的左上角，用于显示
+    Coor rb;              // 外接矩形的右下角（不含），用于显示
+
+    Area(AreaType t=AT_END, int i=-1) : at(t), id(i) { }
+  };
+  typedef vector<Area> AreaVec;
+
+  // 杀手数独的笼子：方格内的数值互不相同，且和为sum。笼子不一定包含全部
+  // 数值，所以不作为区域处理；在待处理区域列表中，第i个笼子的序号为
+  // allAreas_.size() + i。
+  struct Cage {
+    vector<Coor> cells;
+    int sum;
+  };
+
+  // 两个区域的交集，只记录至少有两个方格的交集（见LockedDeduce）。
+  struct AreaPair {
+    int area1, area2;
+    vector<Coor> cells;
+  };
+
+  // 方格(x, y)所在的类型为at的区域，at只能是行、列或宫格。只用于单个棋盘。
+  const Area &AreaOf(int x, int y, AreaType at) const {
+    int index = (at == AT_ROW) ? x : (at == AT_COL) ? y : BlockIndex(x, y);
+    return allAreas_[at * SIZE + index];
+  }
+
+  // 同时包含coors中所有方格的区域的序号，记录在ids中。
+  void CommonAreas(const CoorSet &coors, vector<int> &ids) const {
+    ids.clear();
+    if (coors.empty()) return;
+    const Coor &first = *coors.begin();
+    const vector<int> &areas = cellAreas_[first.first * COLS + first.second];
+    for (vector<int>::const_iterator ita = areas.begin();
+         ita != areas.end(); ++ita) {
+      bool common = true;
+      for (CoorSet::const_iterator itc = coors.begin();
+           itc != coors.end() && common; ++itc)
+        common = InArea(*itc, *ita);
+      if (common) ids.push_back(*ita);
+    }
+  }
+
+  // 方格coor是否位于序号为id的区域内。
+  bool InArea(const Coor &coor, int id) const {
+    const vector<int> &areas = cellAreas_[coor.first * COLS + coor.second];
+    return find(areas.begin(), areas.end(), id) != areas.end();
+  }
+
+  // 将方格(x, y)所在的各区域及笼子加入待处理区域列表。
+  void PushAreas(int x, int y) {
+    const vector<int> &areas = cellAreas_[x * COLS + y];
+    areaStack_.insert(areas.begin(), areas.end());
+    int cage = cellCage_[x * COLS + y];
+    if (cage >= 0) areaStack_.insert(allAreas_.size() + cage);
+  }
+
+  // 预先计算cageCombos_：不超过maxCells个互不相同的数值的所有组合。
+  void BuildCageCombos(int maxCells) {
+    int maxSum = SIZE * (SIZE + 1) / 2;
+    cageCombos_.assign(maxCells + 1, vector<vector<ValMask> >(maxSum + 1));
+    AddCageCombos(1, 0, 0, 0, maxCells);
+  }
+
+  void AddCageCombos(int val, int cnt, int sum, ValMask combo, int maxCells) {
+    cageCombos_[cnt][sum].push_back(combo);
+    if (cnt == maxCells) return;
+    for (int vv = val; vv <= SIZE; ++vv)
+      AddCageCombos(vv + 1, cnt + 1, sum + vv, combo | ValBit(vv), maxCells);
+  }
+
+  // 根据grids_和region_生成各子棋盘的行、列、宫格区域，依次为各行、各列、
+  // 各宫格，每类区域内再按子棋盘的顺序排列。只有一个棋盘时，类型为at的第i个
+  // 区域的序号为at * SIZE + i。相邻子棋盘重叠的宫格只生成一次，由两个子棋盘
+  // 共用。variant_指定的附加区域排在最后。
+  void BuildAreas() {
+    allAreas_.clear();
+    for (AreaType at = AT_BEGIN; at <= AT_BLOCK; ++at) {
+      set<int> builtBlocks;
+      for (vector<Coor>::const_iterator itg = grids_.begin();
+           itg != grids_.end(); ++itg) {
+        if (at == AT_BLOCK) {
+          map<int, vector<Coor> > blocks;
+          for (int xx = itg->first; xx < itg->first + SIZE; ++xx)
+            for (int yy = itg->second; yy < itg->second + SIZE; ++yy)
+              blocks[region_[xx * COLS + yy]].push_back(Coor(xx, yy));
+          for (map<int, vector<Coor> >::const_iterator itb = blocks.begin();
+               itb != blocks.end(); ++itb) {
+            if (!builtBlocks.insert(itb->first).second) continue;
+            allAreas_.push_back(Area(at, allAreas_.size()));
+            allAreas_.back().cells = itb->second;
+          }
+          continue;
+        }
+        for (int ii = 0; ii < SIZE; ++ii) {
+          Area area(at, allAreas_.size());
+          for (int jj = 0; jj < SIZE; ++jj) {
+            area.cells.push_back(at == AT_ROW ?
+                Coor(itg->first + ii, itg->second + jj) :
+                Coor(itg->first + jj, itg->second + ii));
+          }
+          allAreas_.push_back(area);
+        }
+      }
+    }
+    for (vector<Coor>::const_iterator itg = grids_.begin();
+         itg != grids_.end(); ++itg)
+      AddVariantAreas(itg->first, itg->second);
+    IndexAreas();
+  }
+
+  // 按variant_为左上角位于(x0, y0)的子棋盘追加附加区域。窗口宫格和同位组按
+  // 规则宫格的位置确定。
+  void AddVariantAreas(int x0, int y0) {
+    if (variant_ & VT_DIAGONAL) {
+      Area main(AT_DIAG, allAreas_.size());
+      Area anti(AT_DIAG, allAreas_.size() + 1);
+      for (int ii = 0; ii < SIZE; ++ii) {
+        main.cells.push_back(Coor(x0 + ii, y0 + ii));
+        anti.cells.push_back(Coor(x0 + ii, y0 + SIZE - 1 - ii));
+      }
+      allAreas_.push_back(main);
+      allAreas_.push_back(anti);
+    }
+    if (variant_ & VT_WINDOKU) {
+      // 窗口宫格与棋盘边缘、彼此之间都间隔一行（列）。
+      for (int wx = 1; wx + BLOCKX < SIZE; wx += BLOCKX + 1) {
+        for (int wy = 1; wy + BLOCKY < SIZE; wy += BLOCKY + 1) {
+          Area window(AT_WINDOW, allAreas_.size());
+          for (int xx = x0 + wx; xx < x0 + wx + BLOCKX; ++xx)
+            for (int yy = y0 + wy; yy < y0 + wy + BLOCKY; ++yy)
+              window.cells.push_back(Coor(xx, yy));
+          allAreas_.push_back(window);
+        }
+      }
+    }
+    if (variant_ & VT_DISJOINT) {
+      for (int pos = 0; pos < SIZE; ++pos) {
+        Area group(AT_GROUP, allAreas_.size());
+        for (int xx = x0 + pos / BLOCKY; xx < x0 + SIZE; xx += BLOCKX)
+          for (int yy = y0 + pos % BLOCKY; yy < y0 + SIZE; yy += BLOCKY)
+            group.cells.push_back(Coor(xx, yy));
+        allAreas_.push_back(group);
+      }
+    }
+  }
+
+  // 根据allAreas_预先计算各区域的外接矩形、每个方格所在的区域、相关方格，
+  // 以及交集至少有两个方格的区域对。
+  void IndexAreas() {
+    int cellCnt = ROWS * COLS;
+    cellAreas_.assign(cellCnt, vector<int>());
+    for (AreaVec::iterator ita = allAreas_.begin();
+         ita != allAreas_.end(); ++ita) {
+      ita->lt = Coor(ROWS, COLS);
+      ita->rb = Coor(0, 0);
+      for (vector<Coor>::const_iterator itc = ita->cells.begin();
+           itc != ita->cells.end(); ++itc) {
+        ita->lt.first = min(ita->lt.first, itc->first);
+        ita->lt.second = min(ita->lt.second, itc->second);
+        ita->rb.first = max(ita->rb.first, itc->first + 1);
+        ita->rb.second = max(ita->rb.second, itc->second + 1);
+        cellAreas_[itc->first * COLS + itc->second].push_back(ita->id);
+      }
+    }
+
+    peer_.assign(cellCnt, BoolVec(cellCnt, false));
+    peers_.assign(cellCnt, vector<int>());
+    for (int ii = 0; ii < cellCnt; ++ii) {
+      const vector<int> &areas = cellAreas_[ii];
+      for (vector<int>::const_iterator ita = areas.begin();
+           ita != areas.end(); ++ita)
+        AddPeers(ii, allAreas_[*ita].cells);
+      // 同一笼子内的数值也互不相同。
+      if (cellCage_[ii] >= 0) AddPeers(ii, cages_[cellCage_[ii]].cells);
+      sort(peers_[ii].begin(), peers_[ii].end());
+    }
+
+    areaPairs_.clear();
+    for (AreaVec::const_iterator ita = allAreas_.begin();
+         ita != allAreas_.end(); ++ita) {
+      map<int, vector<Coor> > inters;
+      for (vector<Coor>::const_iterator itc = ita->cells.begin();
+           itc != ita->cells.end(); ++itc) {
+        const vector<int> &areas = cellAreas_[itc->first * COLS + itc->second];
+        for (vector<int>::const_iterator itb = areas.begin();
+             itb != areas.end(); ++itb)
+          if (*itb > ita->id) inters[*itb].push_back(*itc);
+      }
+      for (map<int, vector<Coor> >::const_iterator iti = inters.begin();
+           iti != inters.end(); ++iti) {
+        if (iti->second.size() < 2) continue;
+        AreaPair pair;
+        pair.area1 = ita->id;
+        pair.area2 = iti->first;
+        pair.cells = iti->second;
+        areaPairs_.push_back(pair);
+      }
+    }
+  }
+
+  // 将cells中的方格记为方格ii的相关方格。
+  void AddPeers(int ii, const vector<Coor> &cells) {
+    for (vector<Coor>::const_iterator itc = cells.begin();
+         itc != cells.end(); ++itc) {
+      int jj = itc->first * COLS + itc->second;
+      if (jj == ii || peer_[ii][jj]) continue;
+      peer_[ii][jj] = true;
+      peers_[ii].push_back(jj);
+    }
+  }
+
+  // 打印区域的名称。不规则的宫格用序号表示，同位组用方格在宫格内的位置
+  // 表示，对角线用端点表示，其余区域用外接矩形表示。有多个子棋盘时，同位组
+  // 再加上外接矩形以区分所在的子棋盘。
+  void ShowArea(const Area &area) const {
+    cout << AREA_TYPE_STR[area.at];
+    if (area.at == AT_BLOCK && !regular_) {
+      cout << "#" << area.id - AT_BLOCK * SIZE + 1 << " ";
+      return;
+    }
+    if (area.at == AT_GROUP) {
+      const Coor &front = area.cells.front();
+      cout << "#" << (front.first % BLOCKX) * BLOCKY + front.second % BLOCKY + 1
+           << " ";
+      if (grids_.size() == 1) return;
+    }
+    if (area.at == AT_DIAG) {
+      const Coor &front = area.cells.front(), &back = area.cells.back();
+      cout << "(" << front.first+1 << "," << front.second+1 << ")-"
+           << "(" << back.first+1 << "," << back.second+1 << ") ";
+      return;
+    }
+    cout << "(" << area.lt.first+1 << "," << area.lt.second+1 << ")-"
+         << "(" << area.rb.first << "," << area.rb.second << ") ";
+  }
+
+  // 方格(x, y)所在的各区域在areaMask中的掩码之并集。
+  ValMask AreasMask(int x, int y, const vector<ValMask> &areaMask) const {
+    ValMask mask = 0;
+    const vector<int> &areas = cellAreas_[x * COLS + y];
+    for (vector<int>::const_iterator ita = areas.begin();
+         ita != areas.end(); ++ita)
+      mask |= areaMask[*ita];
+    return mask;
+  }
+
+  // 对区域area进行预检查，返回false表示发现矛盾，原因记录在info中。
+  // 用once/twice分别记录区域内出现过至少一次、两次的候选数，于是
+  // once & ~twice 就是只有一个候选方格的数字。
+  bool PreCheckArea(const Area &area, CheckInfo &info) const {
+    const ValMask full = FullMask(SIZE);
+    ValMask given = 0, once = 0, twice = 0;
+    for (vector<Coor>::const_iterator itc = area.cells.begin();
+         itc != area.cells.end(); ++itc) {
+      int xx = itc->first, yy = itc->second;
+      ValMask mask = board_[xx][yy];
+      if (mark_[xx][yy]) {
+        if ((given & mask) != 0) {
+          info.failure = CF_DUPLICATE;
+          info.area = area.id;
+          info.coor = Coor(xx, yy);
+          info.val1 = MaskToVal(board_[xx][yy]);
+          return false;
+        }
+        given |= mask;
+      }
+      twice |= once & mask;
+      once |= mask;
+    }
+
+    if ((once & full) != full) {
+      info.failure = CF_NO_POSITION;
+      info.area = area.id;
+      info.coor = area.lt;
+      for (int val = 1; val <= SIZE; ++val) {
+        if (HasVal(once, val)) continue;
+        info.val1 = val;
+        break;
+      }
+      return false;
+    }
+
+    ValMask single = once & ~twice;
+    for (vector<Coor>::const_iterator itc = area.cells.begin();
+         itc != area.cells.end(); ++itc) {
+      int xx = itc->first, yy = itc->second;
+      ValMask mask = board_[xx][yy] & single;
+      if (BitCount(mask) < 2) continue;
+      info.failure = CF_PIGEONHOLE;
+      info.area = area.id;
+      info.coor = Coor(xx, yy);
+      for (int val = 1; val <= SIZE; ++val) {
+        if (!HasVal(mask, val)) continue;
+        if (info.val1 == NO_VAL) {
+          info.val1 = val;
+        } else {
+          info.val2 = val;
+          break;
+        }
+      }
+      return false;
+    }
+
+    return true;
+  }
+
+  // 方格(x, y)是否属于某个子棋盘，即是否参与求解。
+  bool IsActive(int x, int y) const {
+    return active_[x * COLS + y];
+  }
+
+  // 方格(x, y)所在宫格的序号。规则的宫格按行优先的顺序编号。
+  int BlockIndex(int x, int y) const {
+    return region_[x * COLS + y];
+  }
+
+  // 将棋盘上的所有区域及笼子加入待处理区域列表。
+  void PushAllAreas() {
+    for (int ii = 0; ii < (int)(allAreas_.size() + cages_.size()); ++ii)
+      areaStack_.insert(areaStack_.end(), ii);
+  }
+
+  // 判断两个不同的方格是否位于同一区域内。
+  bool IsPeer(const Coor &coor1, const Coor &coor2) const {
+    return peer_[coor1.first * COLS + coor1.second]
+                [coor2.first * COLS + coor2.second];
+  }
+
+  // 判断方格coor是否与coors中的每一个方格都位于同一行、列或宫格内。
+  bool IsPeerOfAll(const Coor &coor, const CoorSet &coors) const {
+    for (CoorSet::const_iterator itc = coors.begin();
+         itc != coors.end(); ++itc)
+      if (!IsPeer(coor, *itc)) return false;
+    return true;
+  }
+
+  // 对当前棋盘进行一次推导。
+  Status DoDeduce(bool guessing) {
+    Status res;
+    do {
+      if (!config_.disableNaked || !config_.disableHidden || !cages_.empty()) {
+        while (!areaStack_.empty()) {
+          int id = *areaStack_.begin();
+          if (id >= (int)allAreas_.size()) {
+            // 笼子总是排在区域之后，笼子删减了候选数时会再次加入列表。
+            areaStack_.erase(areaStack_.begin());
+            res = CageDeduce(cages_[id - allAreas_.size()], ShowMsg(guessing));
+            if (res == S_FAILED) return S_FAILED;
+            continue;
+          }
+          const Area &area = allAreas_[id];
+          bool finished = true;
+          if (!config_.disableNaked) {
+            res = SubsetDeduce(area, true, guessing);
+            CHECK_STATUS(res, finished);
+            CountRule(DR_NAKED, res);
+          }
+          if (!config_.disableHidden) {
+            res = SubsetDeduce(area, false, guessing);
             CHECK_STATUS(res, finished);
+            CountRule(DR_HIDDEN, res);
           }
           if (finished) {
-            areaStack_.erase(area);
-          } else if ((guessing && g_show_board_guess) ||
-                     (!guessing && g_show_board_deduce)) {
+            areaStack_.erase(area.id);
+          } else if (ShowBoard(guessing)) {
             PrintBoardAll("推导步骤：");
           }
         }
       }
 
-      if (g_disable_lines_deduce) break;
       bool finished = true;
-      if (finished) {
+      if (finished && !config_.disableHidden) {
+        res = LockedDeduce(guessing);
+        CHECK_STATUS(res, finished);
+        CountRule(DR_HIDDEN, res);
+      }
+      // 链列推导按整行、整列处理，只用于单个棋盘；带鳍链列推导还依赖于
+      // 宫格与行列的对齐关系，只用于规则的宫格。
+      bool lines = !config_.disableLines && grids_.size() == 1;
+      bool finned = !config_.disableFinned && regular_;
+      if (finished && lines) {
         res = LinesDeduce(true, guessing);
         CHECK_STATUS(res, finished);
+        CountRule(DR_LINES, res);
       }
-      if (finished) {
+      if (finished && lines) {
         res = LinesDeduce(false, guessing);
         CHECK_STATUS(res, finished);
+        CountRule(DR_LINES, res);
+      }
+      if (finished && lines && finned) {
+        res = FinnedLinesDeduce(true, guessing);
+        CHECK_STATUS(res, finished);
+        CountRule(DR_FINNED, res);
+      }
+      if (finished && lines && finned) {
+        res = FinnedLinesDeduce(false, guessing);
+        CHECK_STATUS(res, finished);
+        CountRule(DR_FINNED, res);
+      }
+      if (finished && config_.assumeUnique) {
+        res = UniqueDeduce(guessing);
+        CHECK_STATUS(res, finished);
+        CountRule(DR_UNIQUE, res);
+      }
+      if (finished && !config_.disableWing) {
+        res = WingsDeduce(guessing);
+        CHECK_STATUS(res, finished);
+        CountRule(DR_WING, res);
+      }
+      if (finished && !config_.disableChain) {
+        res = ChainsDeduce(guessing);
+        CHECK_STATUS(res, finished);
+        CountRule(DR_CHAIN, res);
+      }
+      if (finished && !config_.disableAls) {
+        res = AlsDeduce(guessing);
+        CHECK_STATUS(res, finished);
+        CountRule(DR_ALS, res);
+      }
+      if (finished && !config_.disableForcing) {
+        res = ForcingDeduce(guessing);
+        CHECK_STATUS(res, finished);
+        CountRule(DR_FORCING, res);
       }
       if (finished) {
         break;
-      } else if ((guessing && g_show_board_guess) ||
-                 (!guessing && g_show_board_deduce)) {
+      } else if (ShowBoard(guessing)) {
         PrintBoardAll("推导步骤：");
       }
     } while (!areaStack_.empty());
@@ -507,85 +1982,12 @@ class ShuduSolver {
   //    和k链数删减法。
   //  3.若 p > q
   //    不可能，因为这p个方格中至少有p-q个方格没有数字可放。
-  typedef pair<Coor, NumSet> CellInfo;
-  struct LTCellInfo
-      : public binary_function<const CellInfo&, const CellInfo&, bool> {
-    bool operator()(const CellInfo &cellInfo1, const CellInfo &cellInfo2) {
-      return cellInfo1.second.size() < cellInfo2.second.size();
-    }
-  };
-  Status NakedDeduce(const Area &area, bool guessing) {
-    // 记录每个方格的候选数，忽略已经确定的方格。
-    typedef vector<CellInfo> CellInfoVec;
-    CellInfoVec cellInfoVec;
-    for (int xx = area.lt.first; xx < area.rb.first; ++xx) {
-      for (int yy = area.lt.second; yy < area.rb.second; ++yy) {
-        if (mark_[xx][yy]) continue;
-        cellInfoVec.push_back(CellInfo(Coor(xx, yy), board_[xx][yy]));
-      }
-    }
-    if (cellInfoVec.empty()) return S_FINISHED;
-    sort(cellInfoVec.begin(), cellInfoVec.end(), LTCellInfo());
-
-    bool finished = true;
-    Status res;
-    int levelLimit = min(max(g_level_naked_deduce, 1), SIZE-1);
-
-    // 对方格个数（规则等级）进行遍历。
-    int n = 0;
-    for (int l = 1; l <= min((int)cellInfoVec.size(), levelLimit); ++l) {
-      while (n < cellInfoVec.size() && cellInfoVec[n].second.size() <= l) ++n;
-      if (l > n) continue;
-      BoolVec tags(l, true);
-      tags.insert(tags.end(), n - l, false);
-      bool tagsChanged = false;
-      do {  // 遍历所有组合
-        tagsChanged = false;
-        CoorSet coors;
-        NumSet vals;
-        CellInfoVec::const_iterator iti = cellInfoVec.begin();
-        for (BoolVec::const_iterator itt = tags.begin();
-             itt != tags.end(); ++itt, ++iti) {
-          if (!*itt) continue;
-          coors.insert(iti->first);
-          vals.insert(iti->second.begin(), iti->second.end());
-        }
-
-        int p = coors.size();
-        int q = vals.size();
-        if (p < q) {
-          continue;
-        } else if (p > q) {
-          return S_FAILED;
-        }
-
-        res = SetPossible(coors, vals, area.at, OR_AREA);
-        CHECK_STATUS(res, finished);
-        if (res == S_NORMAL) {
-          if ((guessing && g_show_msg_guess) || (!guessing && g_show_msg_deduce))
-            ShowNakedDeduceMsg(coors, vals, area);
-          if (!g_disable_shorten_deduce)
-            return S_NORMAL;
-        }
-
-        n -= l;
-        if (!ChangeVecWithTags(cellInfoVec, tags, l)) break;
-        tagsChanged = true;
-      } while (tagsChanged || prev_permutation(tags.begin(), tags.end()));
-    }
-
-    return finished ? S_FINISHED : S_NORMAL;
-  }
-
+  //
   // 在区域area内进行隐性推导，使用的规则包括但不限于：
   //  1.隐性唯一候选数法(Hidden Singles Candidature, Unique Candidate)：
   //    若某个数字在区域内各方格的候选数中只出现一次，则候选数包含这个数字的
   //    方格就只能填入此数字。
-  //  2.区块删减法(Locked Candidates, Single Sector Candidates)：
-  //    若某个数字只出现在区域内的几个方格的候选数中，则可从其他方格的候选数
-  //    中删除这个数字；
-  //    其他方格是指包含这几个方格的其他区域中，这些方格以外的所有方格。
-  //  3.隐性数对删减法(Hidden Pairs)、隐性三链数删减法(Hidden Triples)、
+  //  2.隐性数对删减法(Hidden Pairs)、隐性三链数删减法(Hidden Triples)、
   //  隐性k链数删减法：
   //    若某k个数字只出现在k个方格的候选数中，则可将这些方格的其他候选数删除。
   // 具体地说，此处使用的规则为：
@@ -602,122 +2004,302 @@ class ShuduSolver {
   //  3.若 p > q
   //    显然其他方格内不可能出现这q个数字，
   //    因此将这q个数字从其他方格的候选数中删除。（其他方格意义同上）
-  //    这里q取1对应于区块删减法。
-  typedef pair<int, CoorSet> ValInfo;
-  struct LTValInfo
-      : public binary_function<const ValInfo&, const ValInfo&, bool> {
-    bool operator()(const ValInfo &valInfo1, const ValInfo &valInfo2) {
-      return valInfo1.second.size() < valInfo2.second.size();
+  //    这里q取1对应于区块删减法。此情形由LockedDeduce在整个棋盘范围内
+  //    统一处理，这里只处理 p <= q 的情形。
+  //
+  // 两种推导是同一个二分图（一侧为区域内未确定的方格，另一侧为数字）上的
+  // 同一种搜索：naked为true时以方格为选取的一侧，否则以数字为选取的一侧。
+  // 选取的项按另一侧的度数排序，逐级（k = 1, 2, ...）按字典序寻找并集
+  // 不超过k项的k项组合，处理后将其从选取的一侧中删除并继续。
+  // 设选取的一侧还剩n项，若两侧恰好能完全匹配（见IsTight），则k项组合的
+  // 并集恰为k项当且仅当另一侧其余的n-k项的并集恰为选取一侧其余的n-k项。
+  // 因此 k > n/2 时改为遍历另一侧的n-k项组合，再从中取字典序最小的补集，
+  // 两侧都只需遍历不超过n/2项的组合，找到的链数及其顺序与逐个遍历相同。
+  typedef pair<Coor, ValMask> CellInfo;
+  struct LTCellInfo {
+    bool operator()(const CellInfo &cellInfo1,
+                    const CellInfo &cellInfo2) const {
+      return BitCount(cellInfo1.second) < BitCount(cellInfo2.second);
     }
   };
-  Status HiddenDeduce(const Area &area, bool guessing) {
-    // 记录每个数字的候选方格，忽略已经确定的方格。
-    typedef map<int, CoorSet> ValMap;
-    ValMap valMap;
-    for (int xx = area.lt.first; xx < area.rb.first; ++xx) {
-      for (int yy = area.lt.second; yy < area.rb.second; ++yy) {
-        if (mark_[xx][yy]) continue;
-        const NumSet &possible = board_[xx][yy];
-        for (NumSet::const_iterator it = possible.begin();
-             it != possible.end(); ++it)
-          valMap[*it].insert(Coor(xx, yy));
+  typedef pair<int, ValMask> SubsetItem;
+  struct LTSubsetItem {
+    bool operator()(const SubsetItem &item1, const SubsetItem &item2) const {
+      return MaskCount(item1.second) < MaskCount(item2.second);
+    }
+  };
+  Status SubsetDeduce(const Area &area, bool naked, bool guessing) {
+    // 记录区域内未确定的方格及其候选数。
+    vector<Coor> cells;
+    vector<ValMask> cellMasks;
+    for (vector<Coor>::const_iterator itc = area.cells.begin();
+         itc != area.cells.end(); ++itc) {
+      if (mark_[itc->first][itc->second]) continue;
+      cells.push_back(*itc);
+      cellMasks.push_back(board_[itc->first][itc->second]);
+    }
+    if (cells.empty()) return S_FINISHED;
+
+    // 选取的一侧：方格的序号及其候选数，或者数字及其候选方格的序号。
+    vector<SubsetItem> items;
+    if (naked) {
+      for (int ii = 0; ii < (int)cells.size(); ++ii)
+        items.push_back(SubsetItem(ii, cellMasks[ii]));
+    } else {
+      for (int val = 1; val <= SIZE; ++val) {
+        ValMask mask = 0;
+        for (int ii = 0; ii < (int)cells.size(); ++ii)
+          if (HasVal(cellMasks[ii], val)) SetMaskBit(mask, ii);
+        if (mask != 0) items.push_back(SubsetItem(val, mask));
       }
     }
-    if (valMap.empty()) return S_FINISHED;
-    typedef vector<ValInfo> ValInfoVec;
-    ValInfoVec valInfoVec(valMap.begin(), valMap.end());
-    sort(valInfoVec.begin(), valInfoVec.end(), LTValInfo());
+    sort(items.begin(), items.end(), LTSubsetItem());
 
     bool finished = true;
     Status res;
-    int levelLimit = min(max(g_level_hidden_deduce, 1), SIZE-1);
+    int levelLimit = min(max(naked ? config_.levelNaked : config_.levelHidden,
+                             1), SIZE-1);
 
-    // 对数字个数（规则等级）进行遍历。
+    // 对选取的项数（规则等级）进行遍历。
     int n = 0;
-    for (int l = 1; l <= min((int)valInfoVec.size(), levelLimit); ++l) {
-      while (n < valInfoVec.size() && valInfoVec[n].second.size() <= l) ++n;
+    for (int l = 1; l <= min((int)items.size(), levelLimit); ++l) {
+      while (n < (int)items.size() && MaskCount(items[n].second) <= l) ++n;
       if (l > n) continue;
-      BoolVec tags(l, true);
-      tags.insert(tags.end(), n - l, false);
-      bool tagsChanged = false;
-      do {  // 遍历所有组合
-        tagsChanged = false;
-        NumSet vals;
-        CoorSet coors;
-        ValInfoVec::const_iterator iti = valInfoVec.begin();
-        for (BoolVec::const_iterator itt = tags.begin();
-             itt != tags.end(); ++itt, ++iti) {
-          if (!*itt) continue;
-          vals.insert(iti->first);
-          coors.insert(iti->second.begin(), iti->second.end());
-        }
-
-        int p = coors.size();
-        int q = vals.size();
-        if (p < q) {
-          return S_FAILED;
-        } else if (p > q) {
-          continue;
+      for (int start = 0; start + l <= n; ) {
+        vector<ValMask> masks;
+        for (int ii = 0; ii < (int)items.size(); ++ii)
+          masks.push_back(items[ii].second);
+        ValMask combo, other;
+        if (2 * l > (int)items.size() && IsTight(masks)) {
+          if (!FindComplement(masks, l, combo, other)) break;
+        } else {
+          vector<pair<ValMask, ValMask> > found;
+          if (!FindSubsets(masks, n, l, l, start, true, found)) break;
+          combo = found[0].first;
+          other = found[0].second;
+          if (MaskCount(other) < l) return S_FAILED;
         }
 
-        res = SetPossible(coors, vals, area.at, OR_CELL | OR_OTHER_AREA);
+        res = ApplySubset(area, naked, cells, items, combo, other, guessing);
         CHECK_STATUS(res, finished);
-        if (res == S_NORMAL) {
-          if ((guessing && g_show_msg_guess) || (!guessing && g_show_msg_deduce))
-            ShowHiddenDeduceMsg(coors, vals, area);
-          if (!g_disable_shorten_deduce)
-            return S_NORMAL;
-        }
+        if (res == S_NORMAL && !config_.disableShorten)
+          return S_NORMAL;
 
+        // 删除找到的链数，从其第一项的位置继续遍历。
+        start = MaskLowest(combo);
+        vector<SubsetItem> rest;
+        for (int ii = 0; ii < (int)items.size(); ++ii)
+          if (!TestMaskBit(combo, ii)) rest.push_back(items[ii]);
+        items.swap(rest);
         n -= l;
-        if (!ChangeVecWithTags(valInfoVec, tags, l)) break;
-        tagsChanged = true;
-      } while (tagsChanged || prev_permutation(tags.begin(), tags.end()));
+      }
     }
 
-    if (!finished) return S_NORMAL;
+    return finished ? S_FINISHED : S_NORMAL;
+  }
 
-    // 隐式规则允许 p > q，在此处理。
-    valInfoVec.clear();
-    valInfoVec.insert(valInfoVec.end(), valMap.begin(), valMap.end());
-    levelLimit = min(levelLimit, max(BLOCKX, BLOCKY)) + 1;
-    n = valInfoVec.size();
-    for (int l = 1; l < min(n, levelLimit); ++l) {
-      BoolVec tags(l, true);
-      tags.insert(tags.end(), n - l, false);
-      do {  // 遍历所有组合
-        NumSet vals;
-        CoorSet coors;
-        ValInfoVec::const_iterator iti = valInfoVec.begin();
-        for (BoolVec::const_iterator itt = tags.begin();
-             itt != tags.end(); ++itt, ++iti) {
-          if (!*itt) continue;
-          vals.insert(iti->first);
-          coors.insert(iti->second.begin(), iti->second.end());
-        }
+  // 在masks的前n项中按字典序遍历首项不早于start的k项组合，并集超过
+  // maxOther项的组合被剪枝。firstOnly为true时找到第一个并集不超过maxOther项
+  // 的组合即停止，否则找出所有这样的组合。每个组合记录为(所选项序号的掩码,
+  // 并集)。
+  static bool FindSubsets(const vector<ValMask> &masks, int n, int k,
+                          int maxOther, int start, bool firstOnly,
+                          vector<pair<ValMask, ValMask> > &found) {
+    SearchSubsets(masks, n, k, maxOther, firstOnly, start, 0, 0, 0, found);
+    return !found.empty();
+  }
 
-        int p = coors.size();
-        int q = vals.size();
-        if (p < q) {
-          return S_FAILED;
-        } else if (p == q) {
-          continue;
-        }
+  // FindSubsets的递归部分，已经选取了picked项。返回true表示可以停止搜索。
+  static bool SearchSubsets(const vector<ValMask> &masks, int n, int k,
+                            int maxOther, bool firstOnly, int pos, int picked,
+                            const ValMask &combo, const ValMask &other,
+                            vector<pair<ValMask, ValMask> > &found) {
+    if (picked == k) {
+      found.push_back(make_pair(combo, other));
+      return firstOnly;
+    }
+    for (int ii = pos; ii <= n - (k - picked); ++ii) {
+      ValMask next = other | masks[ii];
+      if (MaskCount(next) > maxOther) continue;
+      ValMask nextCombo = combo;
+      SetMaskBit(nextCombo, ii);
+      if (SearchSubsets(masks, n, k, maxOther, firstOnly, ii + 1, picked + 1,
+                        nextCombo, next, found))
+        return true;
+    }
+    return false;
+  }
 
-        res = SetPossible(coors, vals, area.at, OR_OTHER_AREA);
-        CHECK_STATUS(res, finished);
-        if (res == S_NORMAL) {
-          if ((guessing && g_show_msg_guess) || (!guessing && g_show_msg_deduce))
-            ShowHiddenDeduceMsg(coors, vals, area);
-          if (!g_disable_shorten_deduce)
-            return S_NORMAL;
+  // 判断masks描述的二分图是否两侧项数相等且能完全匹配（即满足Hall条件，
+  // 任意k项的并集都不少于k项）。
+  static bool IsTight(const vector<ValMask> &masks) {
+    ValMask all = 0;
+    for (int ii = 0; ii < (int)masks.size(); ++ii) all |= masks[ii];
+    if (MaskCount(all) != (int)masks.size()) return false;
+    vector<int> matchOf(MAX_SIZE, -1);
+    for (int ii = 0; ii < (int)masks.size(); ++ii) {
+      ValMask seen = 0;
+      if (!AugmentMatch(masks, ii, seen, matchOf)) return false;
+    }
+    return true;
+  }
+  static bool AugmentMatch(const vector<ValMask> &masks, int left,
+                           ValMask &seen, vector<int> &matchOf) {
+    ValMask cand = masks[left] & ~seen;
+    for (int right = MaskLowest(cand); right >= 0;
+         right = MaskLowest(cand)) {
+      SetMaskBit(seen, right);
+      cand = masks[left] & ~seen;
+      if (matchOf[right] < 0 ||
+          AugmentMatch(masks, matchOf[right], seen, matchOf)) {
+        matchOf[right] = left;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // 两侧完全匹配时，遍历另一侧的n-k项组合，求出并集恰为k项的k项组合中
+  // 字典序最小的一个。返回false表示不存在这样的组合。
+  static bool FindComplement(const vector<ValMask> &masks, int k,
+                             ValMask &combo, ValMask &other) {
+    int n = masks.size();
+    int m = n - k;
+    ValMask all = 0;
+    for (int ii = 0; ii < n; ++ii) all |= masks[ii];
+
+    // 另一侧每一项在选取一侧的邻居，度数超过m的项不可能出现在组合中。
+    vector<ValMask> rightMasks;
+    for (int right = 0; right < MAX_SIZE; ++right) {
+      if (!TestMaskBit(all, right)) continue;
+      ValMask mask = 0;
+      for (int ii = 0; ii < n; ++ii)
+        if (TestMaskBit(masks[ii], right)) SetMaskBit(mask, ii);
+      if (MaskCount(mask) <= m) rightMasks.push_back(mask);
+    }
+
+    vector<pair<ValMask, ValMask> > found;
+    if (!FindSubsets(rightMasks, rightMasks.size(), m, m, 0, false, found))
+      return false;
+    ValMask full = 0;
+    for (int ii = 0; ii < n; ++ii) SetMaskBit(full, ii);
+    for (size_t ii = 0; ii < found.size(); ++ii) {
+      ValMask cand = full & ~found[ii].second;
+      // 两个等长组合中，对称差的最低位所在的组合字典序较小。
+      if (ii > 0 && !TestMaskBit(cand, MaskLowest(cand ^ combo))) continue;
+      combo = cand;
+    }
+    other = 0;
+    for (int ii = 0; ii < n; ++ii)
+      if (TestMaskBit(combo, ii)) other |= masks[ii];
+    return true;
+  }
+
+  // 应用SubsetDeduce找到的一组链数：combo为items中所选项序号的掩码，other为
+  // 它们在另一侧的并集（数字以val-1、方格以在cells中的序号表示）。
+  Status ApplySubset(const Area &area, bool naked, const vector<Coor> &cells,
+                     const vector<SubsetItem> &items, const ValMask &combo,
+                     const ValMask &other, bool guessing) {
+    CoorSet coors;
+    ValMask vals = naked ? other : 0;
+    for (int ii = 0; ii < (int)items.size(); ++ii) {
+      if (!TestMaskBit(combo, ii)) continue;
+      if (naked) coors.insert(cells[items[ii].first]);
+      else vals |= ValBit(items[ii].first);
+    }
+    for (int ii = 0; !naked && ii < (int)cells.size(); ++ii)
+      if (TestMaskBit(other, ii)) coors.insert(cells[ii]);
+
+    Status res = SetPossible(coors, vals, area.id,
+                             naked ? OR_AREA : OR_CELL | OR_OTHER_AREA);
+    if (res == S_NORMAL && ShowMsg(guessing)) {
+      if (naked) ShowNakedDeduceMsg(coors, vals, area);
+      else ShowHiddenDeduceMsg(coors, vals, area);
+    }
+    return res;
+  }
+
+  // 在棋盘范围内进行区块删减推导(Locked Candidates)：
+  //  1.宫格对行列的区块删减(Pointing)：
+  //    若某个数字在宫格内只出现在某一行（列）与宫格的交集中，则此行（列）的
+  //    其他方格内不可能出现此数字。
+  //  2.行列对宫格的区块删减(Claiming)：
+  //    若某个数字在某一行（列）内只出现在此行（列）与某宫格的交集中，则此宫格
+  //    的其他方格内不可能出现此数字。
+  // 这相当于隐式推导中 q = 1 且 p > q 的情形（q > 1 时的删减都可以由逐个
+  // 数字的删减得到）。推广到任意两个区域：若某个数字在一个区域内只出现在
+  // 两个区域的交集中，则另一个区域的其他方格内不可能出现此数字，因此不规则
+  // 宫格同样适用。只有一个方格的交集上的删减就是隐性唯一候选数，不必处理。
+  // 这里先求出每个方格的候选数掩码，再对每个区域对用位运算比较“交集内”与
+  // 两个区域内其余部分的候选数，一遍即可处理整个棋盘。
+  Status LockedDeduce(bool guessing) {
+    bool finished = true;
+    Status res;
+    vector<ValMask> masks(ROWS * COLS, 0);
+    for (int xx = 0; xx < ROWS; ++xx)
+      for (int yy = 0; yy < COLS; ++yy)
+        if (!mark_[xx][yy]) masks[xx * COLS + yy] = board_[xx][yy];
+
+    for (vector<AreaPair>::const_iterator itp = areaPairs_.begin();
+         itp != areaPairs_.end(); ++itp) {
+      ValMask inter = 0;
+      for (vector<Coor>::const_iterator itc = itp->cells.begin();
+           itc != itp->cells.end(); ++itc)
+        inter |= masks[itc->first * COLS + itc->second];
+      if (inter == 0) continue;
+      const Area &area1 = allAreas_[itp->area1];
+      const Area &area2 = allAreas_[itp->area2];
+      ValMask rest1 = AreaMaskExcept(area1, area2.id, masks);
+      ValMask rest2 = AreaMaskExcept(area2, area1.id, masks);
+
+      // 行（列）与宫格的区域对中，area1为行（列），area2为宫格，于是
+      // pointing为宫格对行列的删减，claiming为行列对宫格的删减。
+      ValMask pointing = inter & ~rest2 & rest1;
+      ValMask claiming = inter & ~rest1 & rest2;
+      if (pointing == 0 && claiming == 0) continue;
+
+      for (int val = 1; val <= SIZE; ++val) {
+        bool isPointing = HasVal(pointing, val);
+        if (!isPointing && !HasVal(claiming, val)) continue;
+        const Area &srcArea = isPointing ? area2 : area1;
+        const Area &dstArea = isPointing ? area1 : area2;
+
+        CoorSet coors;
+        for (vector<Coor>::const_iterator itc = itp->cells.begin();
+             itc != itp->cells.end(); ++itc)
+          if (HasVal(masks[itc->first * COLS + itc->second], val))
+            coors.insert(*itc);
+        bool removed = false;
+        for (vector<Coor>::const_iterator itc = dstArea.cells.begin();
+             itc != dstArea.cells.end(); ++itc) {
+          int xx = itc->first, yy = itc->second;
+          if (mark_[xx][yy] || coors.find(*itc) != coors.end()) continue;
+          res = RemovePossible(xx, yy, val);
+          CHECK_STATUS(res, finished);
+          if (res == S_NORMAL) removed = true;
         }
-      } while (prev_permutation(tags.begin(), tags.end()));
+        if (!removed) continue;
+
+        if (ShowMsg(guessing))
+          ShowHiddenDeduceMsg(coors, ValBit(val), srcArea);
+        if (!config_.disableShorten)
+          return S_NORMAL;
+      }
     }
 
     return finished ? S_FINISHED : S_NORMAL;
   }
 
+  // 区域area内不在序号为other的区域中的方格的候选数掩码之并集。
+  ValMask AreaMaskExcept(const Area &area, int other,
+                         const vector<ValMask> &masks) const {
+    ValMask mask = 0;
+    for (vector<Coor>::const_iterator itc = area.cells.begin();
+         itc != area.cells.end(); ++itc)
+      if (!InArea(*itc, other)) mask |= masks[itc->first * COLS + itc->second];
+    return mask;
+  }
+
   // 在棋盘范围内进行链列推导，rowFirst指定以行优先还是以列优先进行处理，
   // 使用的规则包括但不限于：
   //  1. 矩形顶点删减法(X-Wing)、三链列删减法(Swordfish)、k链列删减法：
@@ -736,6 +2318,8 @@ class ShuduSolver {
   //  3.若 p > q
   //    不可能，因为这p行中至少有p-q行无处放置此数。
   typedef pair<int, NumSet> LineInfo;
+  typedef map<int, NumSet> LineMap;
+  typedef map<int, LineMap> ValsLineMap;
   struct LTLineInfo
       : public binary_function<const LineInfo&, const LineInfo&, bool> {
     bool operator()(const LineInfo &lineInfo1, const LineInfo &lineInfo2) {
@@ -744,24 +2328,12 @@ class ShuduSolver {
   };
   Status LinesDeduce(bool rowFirst, bool guessing) {
     // 记录每个数字在每一行的候选列，忽略已经确定的方格。
-    typedef map<int, NumSet> LineMap;
-    typedef map<int, LineMap> ValsLineMap;
     ValsLineMap valsLineMap;
-    for (int xx = 0; xx < SIZE; ++xx) {
-      for (int yy = 0; yy < SIZE; ++yy) {
-        if (mark_[xx][yy]) continue;
-        const NumSet &possible = board_[xx][yy];
-        int line1 = rowFirst ? xx : yy;
-        int line2 = rowFirst ? yy : xx;
-        for (NumSet::const_iterator it = possible.begin();
-             it != possible.end(); ++it)
-          valsLineMap[*it][line1].insert(line2);
-      }
-    }
+    BuildValsLineMap(rowFirst, valsLineMap);
 
     bool finished = true;
     Status res;
-    int levelLimit = min(max(g_level_lines_deduce, 2), SIZE-1) + 1;
+    int levelLimit = min(max(config_.levelLines, 2), SIZE-1) + 1;
 
     // 对数字进行遍历。
     typedef vector<LineInfo> LineInfoVec;
@@ -804,9 +2376,9 @@ class ShuduSolver {
           res = SetPossible(lines1, lines2, val, rowFirst);
           CHECK_STATUS(res, finished);
           if (res == S_NORMAL) {
-            if ((guessing && g_show_msg_guess) || (!guessing && g_show_msg_deduce))
+            if (ShowMsg(guessing))
               ShowBoardDeduceMsg(val, lines1, lines2, rowFirst);
-            if (!g_disable_shorten_deduce)
+            if (!config_.disableShorten)
               return S_NORMAL;
           }
 
@@ -820,7 +2392,1212 @@ class ShuduSolver {
     return finished ? S_FINISHED : S_NORMAL;
   }
 
-  template <typename TVec>
+  // 在棋盘范围内进行翼类推导，按规则等级依次使用：
+  //  1.XY-Wing：
+  //    枢纽方格P的候选数为{x,y}，与P相关的两个翼方格A、B的候选数分别为{x,z}
+  //    和{y,z}。无论P取x还是y，A、B中总有一个是z，因此同时与A、B相关的
+  //    方格内不可能出现z。
+  //  2.XYZ-Wing：
+  //    枢纽方格P的候选数为{x,y,z}，与P相关的两个翼方格的候选数分别为{x,z}
+  //    和{y,z}。P、A、B中必有一个是z，因此同时与这三个方格相关的方格内不可
+  //    能出现z。
+  //  3.W-Wing：
+  //    两个互不相关的方格A、B的候选数都是{x,y}，且存在某个区域，x在其中只有
+  //    两个候选方格，分别与A、B相关。若A、B都不是y，则都是x，于是该区域内x
+  //    无处可放。因此A、B中必有一个是y，同时与A、B相关的方格内不可能出现y。
+  // 这里“相关”是指位于同一行、列或宫格内。
+  Status WingsDeduce(bool guessing) {
+    int level = min(max(config_.levelWing, 1), 3);
+    typedef pair<Coor, ValMask> CellMask;
+    typedef vector<CellMask> CellMaskVec;
+    CellMaskVec bivalues, trivalues;
+    for (int xx = 0; xx < ROWS; ++xx) {
+      for (int yy = 0; yy < COLS; ++yy) {
+        if (mark_[xx][yy]) continue;
+        int len = BitCount(board_[xx][yy]);
+        if (len == 2)
+          bivalues.push_back(CellMask(Coor(xx, yy), board_[xx][yy]));
+        else if (len == 3)
+          trivalues.push_back(CellMask(Coor(xx, yy), board_[xx][yy]));
+      }
+    }
+
+    bool finished = true;
+    Status res;
+
+    // XY-Wing
+    for (CellMaskVec::const_iterator itp = bivalues.begin();
+         itp != bivalues.end(); ++itp) {
+      for (CellMaskVec::const_iterator ita = bivalues.begin();
+           ita != bivalues.end(); ++ita) {
+        ValMask shared = itp->second & ita->second;
+        if (BitCount(shared) != 1 || !IsPeer(itp->first, ita->first))
+          continue;
+        ValMask z = ita->second & ~shared;
+        ValMask maskB = (itp->second & ~shared) | z;
+        for (CellMaskVec::const_iterator itb = ita + 1;
+             itb != bivalues.end(); ++itb) {
+          if (itb->second != maskB || !IsPeer(itp->first, itb->first))
+            continue;
+          CoorSet wing;
+          wing.insert(ita->first);
+          wing.insert(itb->first);
+          CoorSet removed;
+          res = RemoveFromPeers(wing, MaskToVal(z), removed);
+          CHECK_STATUS(res, finished);
+          if (res == S_NORMAL) {
+            wing.insert(itp->first);
+            if (ShowMsg(guessing))
+              ShowWingDeduceMsg("XY-Wing", wing, MaskToVal(z), removed);
+            if (!config_.disableShorten)
+              return S_NORMAL;
+          }
+        }
+      }
+    }
+    if (level < 2) return finished ? S_FINISHED : S_NORMAL;
+
+    // XYZ-Wing
+    for (CellMaskVec::const_iterator itp = trivalues.begin();
+         itp != trivalues.end(); ++itp) {
+      for (CellMaskVec::const_iterator ita = bivalues.begin();
+           ita != bivalues.end(); ++ita) {
+        if ((ita->second & ~itp->second) != 0 ||
+            !IsPeer(itp->first, ita->first))
+          continue;
+        for (CellMaskVec::const_iterator itb = ita + 1;
+             itb != bivalues.end(); ++itb) {
+          if ((itb->second & ~itp->second) != 0 ||
+              (ita->second | itb->second) != itp->second ||
+              !IsPeer(itp->first, itb->first))
+            continue;
+          CoorSet wing;
+          wing.insert(itp->first);
+          wing.insert(ita->first);
+          wing.insert(itb->first);
+          int z = MaskToVal(ita->second & itb->second);
+          CoorSet removed;
+          res = RemoveFromPeers(wing, z, removed);
+          CHECK_STATUS(res, finished);
+          if (res == S_NORMAL) {
+            if (ShowMsg(guessing))
+              ShowWingDeduceMsg("XYZ-Wing", wing, z, removed);
+            if (!config_.disableShorten)
+              return S_NORMAL;
+          }
+        }
+      }
+    }
+    if (level < 3) return finished ? S_FINISHED : S_NORMAL;
+
+    // W-Wing
+    for (CellMaskVec::const_iterator ita = bivalues.begin();
+         ita != bivalues.end(); ++ita) {
+      for (CellMaskVec::const_iterator itb = ita + 1;
+           itb != bivalues.end(); ++itb) {
+        if (itb->second != ita->second || IsPeer(ita->first, itb->first))
+          continue;
+        for (int x = 1; x <= SIZE; ++x) {
+          if (!HasVal(ita->second, x)) continue;
+          int y = MaskToVal(ita->second & ~ValBit(x));
+          Coor link1, link2;
+          if (!FindWWingLink(ita->first, itb->first, x, link1, link2))
+            continue;
+          CoorSet wing;
+          wing.insert(ita->first);
+          wing.insert(itb->first);
+          CoorSet removed;
+          res = RemoveFromPeers(wing, y, removed);
+          CHECK_STATUS(res, finished);
+          if (res == S_NORMAL) {
+            wing.insert(link1);
+            wing.insert(link2);
+            if (ShowMsg(guessing))
+              ShowWingDeduceMsg("W-Wing", wing, y, removed);
+            if (!config_.disableShorten)
+              return S_NORMAL;
+          }
+        }
+      }
+    }
+
+    return finished ? S_FINISHED : S_NORMAL;
+  }
+
+  // 为W-Wing寻找连接方格coor1和coor2的强链：某个区域内数字val只有两个候选
+  // 方格，且分别与coor1、coor2相关（两者都不是coor1或coor2本身）。
+  // 找到时返回true，并将这两个候选方格记录在link1、link2中。
+  bool FindWWingLink(const Coor &coor1, const Coor &coor2, int val,
+                     Coor &link1, Coor &link2) const {
+    for (AreaVec::const_iterator ita = allAreas_.begin();
+         ita != allAreas_.end(); ++ita) {
+      vector<Coor> cells;
+      for (vector<Coor>::const_iterator itc = ita->cells.begin();
+           itc != ita->cells.end(); ++itc) {
+        int xx = itc->first, yy = itc->second;
+        if (mark_[xx][yy] || !HasVal(board_[xx][yy], val)) continue;
+        cells.push_back(Coor(xx, yy));
+      }
+      if (cells.size() != 2) continue;
+      if (cells[0] == coor1 || cells[0] == coor2 ||
+          cells[1] == coor1 || cells[1] == coor2)
+        continue;
+      for (int ii = 0; ii < 2; ++ii) {
+        if (IsPeer(cells[ii], coor1) && IsPeer(cells[1-ii], coor2)) {
+          link1 = cells[ii];
+          link2 = cells[1-ii];
+          return true;
+        }
+      }
+    }
+    return false;
+  }
+
+  // 单数字链推导中，数字val的候选方格及其之间的强链构成的图。
+  // 强链是指某个区域内val只有两个候选方格，这两个方格中必有一个是val；
+  // 弱链是指两个候选方格相关，它们中最多有一个是val。
+  typedef pair<int, AreaType> ChainEdge;  // 强链另一端的节点序号、所在区域
+  typedef vector<ChainEdge> ChainEdgeVec;
+  struct ChainGraph {
+    int val;
+    vector<Coor> nodes;           // 数字val的所有候选方格
+    vector<ChainEdgeVec> strong;  // 每个节点的强链
+  };
+
+  void BuildChainGraph(int val, ChainGraph &graph) const {
+    graph.val = val;
+    graph.nodes.clear();
+    vector<int> index(ROWS * COLS, -1);
+    for (int xx = 0; xx < ROWS; ++xx) {
+      for (int yy = 0; yy < COLS; ++yy) {
+        if (mark_[xx][yy] || !HasVal(board_[xx][yy], val)) continue;
+        index[xx * COLS + yy] = graph.nodes.size();
+        graph.nodes.push_back(Coor(xx, yy));
+      }
+    }
+
+    graph.strong.assign(graph.nodes.size(), ChainEdgeVec());
+    for (AreaVec::const_iterator ita = allAreas_.begin();
+         ita != allAreas_.end(); ++ita) {
+      vector<int> cells;
+      for (vector<Coor>::const_iterator itc = ita->cells.begin();
+           itc != ita->cells.end(); ++itc) {
+        int xx = itc->first, yy = itc->second;
+        int idx = index[xx * COLS + yy];
+        if (idx >= 0) cells.push_back(idx);
+      }
+      if (cells.size() != 2) continue;
+      ChainEdgeVec &edges = graph.strong[cells[0]];
+      bool exists = false;
+      for (ChainEdgeVec::const_iterator ite = edges.begin();
+           ite != edges.end(); ++ite)
+        if (ite->first == cells[1]) exists = true;
+      if (exists) continue;
+      edges.push_back(ChainEdge(cells[1], ita->at));
+      graph.strong[cells[1]].push_back(ChainEdge(cells[0], ita->at));
+    }
+  }
+
+  // 在棋盘范围内对每个数字进行单数字链推导，使用的规则包括：
+  //  1.简单染色法(Simple Coloring)：
+  //    将由强链连通的候选方格交替染成两种颜色，同色方格同真同假，且两种颜色
+  //    中必有一种为真。若某种颜色的两个方格相关，则这种颜色为假，删除这些
+  //    方格中的此数字；若某个方格同时与两种颜色的方格相关，则删除其中的此
+  //    数字。
+  //  2.X链(X-Chain)：
+  //    由强链、弱链交替组成，且两端都是强链的链，其两端方格中必有一个是此
+  //    数字，因此同时与两端相关的方格内不可能出现此数字。
+  //    含两条强链的X链即摩天楼(Skyscraper)和双线风筝(2-String Kite)。
+  // X链中强链的数目不超过规则等级，每次推导最多搜索g_budget_chain_deduce
+  // 个节点，以保证此规则在大棋盘上的代价可控。
+  Status ChainsDeduce(bool guessing) {
+    int level = max(config_.levelChain, 2);
+    int budget = max(config_.budgetChain, 1);
+    bool finished = true;
+    Status res;
+    ChainGraph graph;
+
+    for (int val = 1; val <= SIZE; ++val) {
+      BuildChainGraph(val, graph);
+      if (graph.nodes.empty()) continue;
+
+      res = ColoringDeduce(graph, guessing);
+      CHECK_STATUS(res, finished);
+      if (res == S_NORMAL) {
+        if (!config_.disableShorten) return S_NORMAL;
+        continue;
+      }
+
+      // 逐步加长链的长度，优先找到较短的链。
+      vector<int> path;
+      vector<bool> onPath(graph.nodes.size(), false);
+      CoorSet removed;
+      for (int maxStrong = 2; maxStrong <= level && budget > 0; ++maxStrong) {
+        for (int ii = 0; ii < (int)graph.nodes.size() && budget > 0; ++ii) {
+          path.assign(1, ii);
+          onPath[ii] = true;
+          bool found = SearchXChain(graph, path, onPath, maxStrong, budget,
+                                    removed);
+          onPath.assign(graph.nodes.size(), false);
+          if (!found) continue;
+
+          for (CoorSet::const_iterator itc = removed.begin();
+               itc != removed.end(); ++itc) {
+            res = RemovePossible(itc->first, itc->second, val);
+            CHECK_STATUS(res, finished);
+          }
+          if (ShowMsg(guessing))
+            ShowChainDeduceMsg(graph, path, removed);
+          if (!config_.disableShorten) return S_NORMAL;
+          break;
+        }
+        if (!removed.empty()) break;
+      }
+    }
+
+    return finished ? S_FINISHED : S_NORMAL;
+  }
+
+  // 对graph进行简单染色推导。
+  Status ColoringDeduce(const ChainGraph &graph, bool guessing) {
+    int n = graph.nodes.size();
+    vector<int> color(n, -1);
+    for (int root = 0; root < n; ++root) {
+      if (color[root] >= 0 || graph.strong[root].empty()) continue;
+
+      // 按强链交替染色，得到一个连通分支。
+      vector<int> members(1, root);
+      color[root] = 0;
+      for (int head = 0; head < (int)members.size(); ++head) {
+        int node = members[head];
+        const ChainEdgeVec &edges = graph.strong[node];
+        for (ChainEdgeVec::const_iterator ite = edges.begin();
+             ite != edges.end(); ++ite) {
+          if (color[ite->first] >= 0) continue;
+          color[ite->first] = 1 - color[node];
+          members.push_back(ite->first);
+        }
+      }
+      if (members.size() < 3) continue;
+
+      CoorSet colored[2];
+      for (vector<int>::const_iterator itm = members.begin();
+           itm != members.end(); ++itm)
+        colored[color[*itm]].insert(graph.nodes[*itm]);
+
+      // 同色方格相关，这种颜色为假。
+      CoorSet removed;
+      for (int cc = 0; cc < 2 && removed.empty(); ++cc) {
+        for (CoorSet::const_iterator it1 = colored[cc].begin();
+             it1 != colored[cc].end() && removed.empty(); ++it1) {
+          CoorSet::const_iterator it2 = it1;
+          for (++it2; it2 != colored[cc].end(); ++it2) {
+            if (!IsPeer(*it1, *it2)) continue;
+            removed = colored[cc];
+            break;
+          }
+        }
+      }
+
+      // 方格同时与两种颜色的方格相关。
+      if (removed.empty()) {
+        for (int ii = 0; ii < n; ++ii) {
+          const Coor &coor = graph.nodes[ii];
+          if (colored[0].find(coor) != colored[0].end() ||
+              colored[1].find(coor) != colored[1].end())
+            continue;
+          bool sees[2] = {false, false};
+          for (int cc = 0; cc < 2; ++cc) {
+            for (CoorSet::const_iterator itc = colored[cc].begin();
+                 itc != colored[cc].end(); ++itc) {
+              if (!IsPeer(coor, *itc)) continue;
+              sees[cc] = true;
+              break;
+            }
+          }
+          if (sees[0] && sees[1]) removed.insert(coor);
+        }
+      }
+      if (removed.empty()) continue;
+
+      bool finished = true;
+      Status res;
+      for (CoorSet::const_iterator itc = removed.begin();
+           itc != removed.end(); ++itc) {
+        res = RemovePossible(itc->first, itc->second, graph.val);
+        CHECK_STATUS(res, finished);
+      }
+      if (ShowMsg(guessing))
+        ShowColoringDeduceMsg(graph.val, colored, removed);
+      return finished ? S_FINISHED : S_NORMAL;
+    }
+    return S_FINISHED;
+  }
+
+  // 从path的最后一个节点出发，深度优先搜索X链，链中强链不超过maxStrong条。
+  // path中节点按“强链、弱链”交替相连，path长度为偶数时以强链结尾。
+  // 找到可以删除候选数的X链时返回true，path即为此链，removed记录可以删除
+  // 候选数的方格。
+  bool SearchXChain(const ChainGraph &graph, vector<int> &path,
+                    vector<bool> &onPath, int maxStrong, int &budget,
+                    CoorSet &removed) const {
+    if (--budget < 0) return false;
+    int last = path.back();
+
+    if (path.size() % 2 == 0) {
+      // 以强链结尾，检查同时与两端相关的方格。
+      int strongCnt = path.size() / 2;
+      if (strongCnt >= 2) {
+        const Coor &head = graph.nodes[path.front()];
+        const Coor &tail = graph.nodes[last];
+        for (int ii = 0; ii < (int)graph.nodes.size(); ++ii) {
+          const Coor &coor = graph.nodes[ii];
+          if (IsPeer(coor, head) && IsPeer(coor, tail)) removed.insert(coor);
+        }
+        if (!removed.empty()) return true;
+      }
+      if (strongCnt >= maxStrong) return false;
+
+      // 接一条弱链。
+      for (int ii = 0; ii < (int)graph.nodes.size(); ++ii) {
+        if (onPath[ii] || graph.strong[ii].empty() ||
+            !IsPeer(graph.nodes[last], graph.nodes[ii]))
+          continue;
+        path.push_back(ii);
+        onPath[ii] = true;
+        if (SearchXChain(graph, path, onPath, maxStrong, budget, removed))
+          return true;
+        onPath[ii] = false;
+        path.pop_back();
+        if (budget < 0) return false;
+      }
+    } else {
+      // 接一条强链。
+      const ChainEdgeVec &edges = graph.strong[last];
+      for (ChainEdgeVec::const_iterator ite = edges.begin();
+           ite != edges.end(); ++ite) {
+        if (onPath[ite->first]) continue;
+        path.push_back(ite->first);
+        onPath[ite->first] = true;
+        if (SearchXChain(graph, path, onPath, maxStrong, budget, removed))
+          return true;
+        onPath[ite->first] = false;
+        path.pop_back();
+        if (budget < 0) return false;
+      }
+    }
+    return false;
+  }
+
+  // 返回X链的名称：含两条强链时，两条强链都在行（或都在列）内的为摩天楼，
+  // 一条在行内、一条在列内且由宫格内的弱链相连的为双线风筝。
+  const char *XChainName(const ChainGraph &graph,
+                         const vector<int> &path) const {
+    if (path.size() != 4) return "X-Chain";
+    AreaType at1 = StrongLinkType(graph, path[0], path[1]);
+    AreaType at2 = StrongLinkType(graph, path[2], path[3]);
+    bool line1 = (at1 == AT_ROW || at1 == AT_COL);
+    bool line2 = (at2 == AT_ROW || at2 == AT_COL);
+    if (at1 == at2 && line1) return "Skyscraper";
+    const Coor &coor1 = graph.nodes[path[1]];
+    const Coor &coor2 = graph.nodes[path[2]];
+    if (at1 != at2 && line1 && line2 &&
+        BlockIndex(coor1.first, coor1.second) ==
+        BlockIndex(coor2.first, coor2.second))
+      return "2-String Kite";
+    return "X-Chain";
+  }
+
+  // 返回节点node1、node2之间的强链所在的区域类型，优先返回行或列。
+  AreaType StrongLinkType(const ChainGraph &graph, int node1,
+                          int node2) const {
+    AreaType at = AT_END;
+    const ChainEdgeVec &edges = graph.strong[node1];
+    for (ChainEdgeVec::const_iterator ite = edges.begin();
+         ite != edges.end(); ++ite) {
+      if (ite->first != node2) continue;
+      if (at == AT_END || at == AT_BLOCK) at = ite->second;
+    }
+    const Coor &coor1 = graph.nodes[node1];
+    const Coor &coor2 = graph.nodes[node2];
+    if (coor1.first == coor2.first) return AT_ROW;
+    if (coor1.second == coor2.second) return AT_COL;
+    return at;
+  }
+
+  // 在棋盘范围内进行带鳍链列推导，是对链列推导的扩展，使用的规则包括：
+  //  1.带鳍鱼(Finned X-Wing/Swordfish/...)、
+  //  2.刺身鱼(Sashimi X-Wing/Swordfish/...)：
+  //    若某个数字在某k行里的候选列，除去位于同一个宫格内的若干个“鳍”方格
+  //    之外，仅出现在相同的k列中，则要么某个鳍是这个数字，要么这k行构成
+  //    普通的k链列。两种情况下，这k列中既在鳍所在宫格内、又不在这k行上的
+  //    方格都不可能出现此数字。
+  //    若去掉鳍之后某行只剩下不到两个候选列，即为刺身鱼。
+  // 规则等级和组合的遍历方式与链列推导相同（以行优先为例）：
+  //  任意一个数字val，任意选取p行，对这p行经过的每个宫格，将此宫格外的候选列
+  //  之并集记为C：
+  //  1.若 |C| > p
+  //    不做任何处理。
+  //  2.若 |C| <= p
+  //    从宫格内的列中补足p列作为覆盖列，其余候选方格即为鳍，
+  //    从覆盖列与此宫格的交集中删除不在这p行上的方格的候选数val。
+  Status FinnedLinesDeduce(bool rowFirst, bool guessing) {
+    ValsLineMap valsLineMap;
+    BuildValsLineMap(rowFirst, valsLineMap);
+
+    bool finished = true;
+    Status res;
+    int levelLimit = min(max(config_.levelLines, 2), SIZE-1) + 1;
+    int stack = rowFirst ? BLOCKY : BLOCKX;  // 一个宫格占多少条第二维的线
+
+    // 对数字进行遍历。
+    typedef vector<LineInfo> LineInfoVec;
+    for (ValsLineMap::const_iterator itv = valsLineMap.begin();
+         itv != valsLineMap.end(); ++itv) {
+      int val = itv->first;
+      const LineMap &lineMap = itv->second;
+      if (lineMap.empty()) continue;
+      LineInfoVec lineInfoVec(lineMap.begin(), lineMap.end());
+      sort(lineInfoVec.begin(), lineInfoVec.end(), LTLineInfo());
+
+      // 对行数（规则等级）进行遍历，每行最多比规则等级多出一个宫格的候选列。
+      int n = 0;
+      for (int l = 2; l < min((int)lineInfoVec.size(), levelLimit); ++l) {
+        while (n < (int)lineInfoVec.size() &&
+               (int)lineInfoVec[n].second.size() <= l + stack)
+          ++n;
+        if (l > n) continue;
+        BoolVec tags(l, true);
+        tags.insert(tags.end(), n - l, false);
+        do {  // 遍历所有组合
+          LineInfoVec baseLines;
+          LineInfoVec::const_iterator iti = lineInfoVec.begin();
+          for (BoolVec::const_iterator itt = tags.begin();
+               itt != tags.end(); ++itt, ++iti) {
+            if (*itt) baseLines.push_back(*iti);
+          }
+
+          res = FinnedFishDeduce(val, baseLines, rowFirst, guessing);
+          CHECK_STATUS(res, finished);
+          if (res == S_NORMAL && !config_.disableShorten)
+            return S_NORMAL;
+        } while (prev_permutation(tags.begin(), tags.end()));
+      }
+    }
+
+    return finished ? S_FINISHED : S_NORMAL;
+  }
+
+  // 以baseLines为基础行（或列）寻找数字val的带鳍鱼，并删除相应的候选数。
+  Status FinnedFishDeduce(int val, const vector<LineInfo> &baseLines,
+                          bool rowFirst, bool guessing) {
+    typedef vector<LineInfo> LineInfoVec;
+    int p = baseLines.size();
+    int band = rowFirst ? BLOCKX : BLOCKY;   // 一个宫格占多少条第一维的线
+    int stack = rowFirst ? BLOCKY : BLOCKX;  // 一个宫格占多少条第二维的线
+    NumSet lines1;
+    for (LineInfoVec::const_iterator itb = baseLines.begin();
+         itb != baseLines.end(); ++itb)
+      lines1.insert(itb->first);
+
+    bool finished = true;
+    Status res;
+
+    // 鳍所在的宫格必然经过某一条基础行，依次尝试这些宫格。
+    set<pair<int, int> > finBlocks;
+    for (LineInfoVec::const_iterator itb = baseLines.begin();
+         itb != baseLines.end(); ++itb)
+      for (NumSet::const_iterator itl = itb->second.begin();
+           itl != itb->second.end(); ++itl)
+        finBlocks.insert(make_pair(itb->first / band, *itl / stack));
+
+    for (set<pair<int, int> >::const_iterator itf = finBlocks.begin();
+         itf != finBlocks.end(); ++itf) {
+      int first1 = itf->first * band;
+      int first2 = itf->second * stack;
+
+      // 计算宫格外的候选列，以及宫格内剩余可作为覆盖列的列。
+      NumSet cover, inside;
+      for (LineInfoVec::const_iterator itb = baseLines.begin();
+           itb != baseLines.end(); ++itb) {
+        bool inBand = (itb->first / band == itf->first);
+        for (NumSet::const_iterator itl = itb->second.begin();
+             itl != itb->second.end(); ++itl) {
+          if (inBand && *itl / stack == itf->second)
+            inside.insert(*itl);
+          else
+            cover.insert(*itl);
+        }
+      }
+      if ((int)cover.size() > p) continue;
+      for (NumSet::const_iterator itl = cover.begin(); itl != cover.end(); ++itl)
+        inside.erase(*itl);
+      int more = p - cover.size();
+      if (more > (int)inside.size()) continue;
+
+      // 从宫格内选出more列补充到覆盖列中，剩下的即为鳍。
+      vector<int> insideVec(inside.begin(), inside.end());
+      BoolVec tags(more, true);
+      tags.insert(tags.end(), insideVec.size() - more, false);
+      do {
+        NumSet lines2 = cover;
+        for (int ii = 0; ii < (int)insideVec.size(); ++ii)
+          if (tags[ii]) lines2.insert(insideVec[ii]);
+
+        CoorSet fins;
+        bool sashimi = false;
+        for (LineInfoVec::const_iterator itb = baseLines.begin();
+             itb != baseLines.end(); ++itb) {
+          int body = 0;
+          for (NumSet::const_iterator itl = itb->second.begin();
+               itl != itb->second.end(); ++itl) {
+            if (lines2.find(*itl) != lines2.end()) {
+              ++body;
+              continue;
+            }
+            fins.insert(rowFirst ? Coor(itb->first, *itl) :
+                        Coor(*itl, itb->first));
+          }
+          if (body < 2) sashimi = true;
+        }
+        if (fins.empty()) continue;
+
+        CoorSet removed;
+        for (int ii = first1; ii < first1 + band; ++ii) {
+          if (lines1.find(ii) != lines1.end()) continue;
+          for (int jj = first2; jj < first2 + stack; ++jj) {
+            if (lines2.find(jj) == lines2.end()) continue;
+            int x = rowFirst ? ii : jj;
+            int y = rowFirst ? jj : ii;
+            if (mark_[x][y]) continue;
+            res = RemovePossible(x, y, val);
+            CHECK_STATUS(res, finished);
+            if (res == S_NORMAL) removed.insert(Coor(x, y));
+          }
+        }
+        if (removed.empty()) continue;
+
+        if (ShowMsg(guessing))
+          ShowFinnedDeduceMsg(val, lines1, lines2, fins, removed, sashimi,
+                              rowFirst);
+        if (!config_.disableShorten) return S_NORMAL;
+      } while (prev_permutation(tags.begin(), tags.end()));
+    }
+
+    return finished ? S_FINISHED : S_NORMAL;
+  }
+
+  // 记录每个数字在每一行（rowFirst为false时为每一列）的候选列（行），
+  // 忽略已经确定的方格。
+  void BuildValsLineMap(bool rowFirst, ValsLineMap &valsLineMap) const {
+    for (int xx = 0; xx < ROWS; ++xx) {
+      for (int yy = 0; yy < COLS; ++yy) {
+        if (mark_[xx][yy]) continue;
+        const ValMask &possible = board_[xx][yy];
+        int line1 = rowFirst ? xx : yy;
+        int line2 = rowFirst ? yy : xx;
+        for (int val = 1; val <= SIZE; ++val)
+          if (HasVal(possible, val)) valsLineMap[val][line1].insert(line2);
+      }
+    }
+  }
+
+  // 几乎锁定集(Almost Locked Set, ALS)：同一区域内的p个方格，它们的候选数
+  // 之并集恰好包含p+1个数字。
+  struct Als {
+    CoorSet cells;  // 组成ALS的方格
+    ValMask vals;   // 这些方格的候选数之并集
+  };
+  typedef vector<Als> AlsVec;
+
+  // 在区域area内枚举不超过maxSize个方格的所有ALS，加入alsVec中。
+  // 先将方格按候选数个数排序，对每个p用FindSubsets在候选数不超过p+1个的
+  // 方格中选取并集不超过p+1个数字的组合。found用于去除在不同区域内重复
+  // 找到的ALS。
+  void CollectAls(const Area &area, int maxSize, set<CoorSet> &found,
+                  AlsVec &alsVec) const {
+    typedef vector<CellInfo> CellInfoVec;
+    CellInfoVec cellInfoVec;
+    for (vector<Coor>::const_iterator itc = area.cells.begin();
+         itc != area.cells.end(); ++itc) {
+      int xx = itc->first, yy = itc->second;
+      if (mark_[xx][yy]) continue;
+      cellInfoVec.push_back(CellInfo(Coor(xx, yy), board_[xx][yy]));
+    }
+    sort(cellInfoVec.begin(), cellInfoVec.end(), LTCellInfo());
+    vector<ValMask> masks;
+    for (int ii = 0; ii < (int)cellInfoVec.size(); ++ii)
+      masks.push_back(cellInfoVec[ii].second);
+
+    int n = 0;
+    for (int l = 1; l <= min((int)cellInfoVec.size() - 1, maxSize); ++l) {
+      while (n < (int)cellInfoVec.size() &&
+             BitCount(cellInfoVec[n].second) <= l + 1)
+        ++n;
+      if (l > n) continue;
+      vector<pair<ValMask, ValMask> > subsets;
+      FindSubsets(masks, n, l, l + 1, 0, false, subsets);
+      for (int ii = 0; ii < (int)subsets.size(); ++ii) {
+        if (BitCount(subsets[ii].second) != l + 1) continue;
+        Als als;
+        als.vals = subsets[ii].second;
+        for (int jj = 0; jj < n; ++jj)
+          if (TestMaskBit(subsets[ii].first, jj))
+            als.cells.insert(cellInfoVec[jj].first);
+        if (!found.insert(als.cells).second) continue;
+        alsVec.push_back(als);
+      }
+    }
+  }
+
+  // ALS中候选数包含val的方格。
+  CoorSet AlsCellsWithVal(const Als &als, int val) const {
+    CoorSet coors;
+    for (CoorSet::const_iterator itc = als.cells.begin();
+         itc != als.cells.end(); ++itc) {
+      if (HasVal(board_[itc->first][itc->second], val)) coors.insert(*itc);
+    }
+    return coors;
+  }
+
+  // 在棋盘范围内进行ALS-XZ推导：
+  //  两个没有公共方格的ALS A、B都包含数字x，且A中所有的x候选方格与B中所有
+  //  的x候选方格都两两相关（称x为受限公共数），则x最多只能出现在A、B之一中。
+  //  假设x不在A中，则A锁定为剩下的p个数字；B同理。因此对A、B的任意另一个
+  //  公共数字z，A、B中至少有一个包含z，同时与A、B中所有z候选方格相关的其他
+  //  方格内不可能出现z。
+  // 规则等级指ALS最多包含的方格数。
+  Status AlsDeduce(bool guessing) {
+    int level = min(max(config_.levelAls, 1), SIZE-1);
+    AlsVec alsVec;
+    set<CoorSet> found;
+    for (AreaVec::const_iterator ita = allAreas_.begin();
+         ita != allAreas_.end(); ++ita)
+      CollectAls(*ita, level, found, alsVec);
+
+    // 按数字建立索引。
+    vector<vector<int> > alsByVal(SIZE + 1);
+    for (int ii = 0; ii < (int)alsVec.size(); ++ii)
+      for (int val = 1; val <= SIZE; ++val)
+        if (HasVal(alsVec[ii].vals, val)) alsByVal[val].push_back(ii);
+
+    bool finished = true;
+    Status res;
+    for (int x = 1; x <= SIZE; ++x) {
+      const vector<int> &ids = alsByVal[x];
+      for (int ii = 0; ii < (int)ids.size(); ++ii) {
+        const Als &als1 = alsVec[ids[ii]];
+        CoorSet xCells1 = AlsCellsWithVal(als1, x);
+        for (int jj = ii + 1; jj < (int)ids.size(); ++jj) {
+          const Als &als2 = alsVec[ids[jj]];
+          ValMask zMask = als1.vals & als2.vals & ~ValBit(x);
+          if (zMask == 0 || !IsDisjoint(als1.cells, als2.cells)) continue;
+
+          // 检查x是否为受限公共数。
+          CoorSet xCells2 = AlsCellsWithVal(als2, x);
+          bool restricted = true;
+          for (CoorSet::const_iterator itc = xCells1.begin();
+               itc != xCells1.end() && restricted; ++itc)
+            restricted = IsPeerOfAll(*itc, xCells2);
+          if (!restricted) continue;
+
+          for (int z = 1; z <= SIZE; ++z) {
+            if (!HasVal(zMask, z)) continue;
+            CoorSet zCells = AlsCellsWithVal(als1, z);
+            CoorSet zCells2 = AlsCellsWithVal(als2, z);
+            zCells.insert(zCells2.begin(), zCells2.end());
+            CoorSet removed;
+            res = RemoveFromPeers(zCells, z, removed);
+            CHECK_STATUS(res, finished);
+            if (res == S_NORMAL) {
+              if (ShowMsg(guessing))
+                ShowAlsDeduceMsg(als1, als2, x, z, removed);
+              if (!config_.disableShorten)
+                return S_NORMAL;
+            }
+          }
+        }
+      }
+    }
+
+    return finished ? S_FINISHED : S_NORMAL;
+  }
+
+  static bool IsDisjoint(const CoorSet &coors1, const CoorSet &coors2) {
+    for (CoorSet::const_iterator itc = coors1.begin();
+         itc != coors1.end(); ++itc)
+      if (coors2.find(*itc) != coors2.end()) return false;
+    return true;
+  }
+
+  // 在假设题目有唯一解的前提下进行唯一性推导。若棋盘上出现“致命结构”，即
+  // 它的几个方格可以任意交换两个数字而不影响其他方格，则题目必有多解，因此
+  // 可以删除那些会导致致命结构的候选数。使用的规则包括：
+  //  1.唯一矩形(Unique Rectangle)：
+  //    位于两行、两列且恰好跨越两个宫格的四个方格都包含候选数{a,b}时，它们
+  //    不能最终都只剩下{a,b}。有附加区域时，还要求每个附加区域包含其中零个
+  //    或两个方格，否则交换a、b会破坏附加区域。记候选数恰为{a,b}的方格为底，其余为顶：
+  //    类型1：三个底，则从顶中删除a和b；
+  //    类型2：两个顶都恰好多出同一个数字c，则两个顶中必有一个是c，从同时
+  //      与两个顶相关的方格中删除c；
+  //    类型3：两个顶位于同一区域内，将它们多出的数字看作一个虚拟方格，与区域
+  //      内其他方格组成显式数组，从区域内其他方格中删除这些数字；
+  //    类型4：两个顶位于同一区域内，且a在此区域内只能出现在两个顶中，则从
+  //      两个顶中删除b。
+  //  2.BUG+1(Bivalue Universal Grave)：
+  //    若除一个方格有三个候选数以外，其他未确定的方格都只有两个候选数，则那个
+  //    方格必须填入在其所在行中出现了三次的数字，否则全盘只剩下双值方格，
+  //    构成致命结构。此规则只用于普通数独和锯齿数独。
+  // 这些规则只在指定了g_assume_unique时启用，其推导次数单独统计。
+  Status UniqueDeduce(bool guessing) {
+    bool finished = true;
+    Status res;
+    for (int r1 = 0; r1 < ROWS; ++r1) {
+      for (int r2 = r1 + 1; r2 < ROWS; ++r2) {
+        for (int c1 = 0; c1 < COLS; ++c1) {
+          if (mark_[r1][c1] || mark_[r2][c1]) continue;
+          for (int c2 = c1 + 1; c2 < COLS; ++c2) {
+            if (mark_[r1][c2] || mark_[r2][c2]) continue;
+            Coor corners[4] = {
+              Coor(r1, c1), Coor(r1, c2), Coor(r2, c1), Coor(r2, c2)
+            };
+            if (!IsDeadlyRect(corners)) continue;
+            ValMask masks[4];
+            ValMask common = ~ValMask(0);
+            for (int ii = 0; ii < 4; ++ii) {
+              masks[ii] = board_[corners[ii].first][corners[ii].second];
+              common &= masks[ii];
+            }
+            if (BitCount(common) < 2) continue;
+
+            for (int a = 1; a <= SIZE; ++a) {
+              if (!HasVal(common, a)) continue;
+              for (int b = a + 1; b <= SIZE; ++b) {
+                if (!HasVal(common, b)) continue;
+                res = UniqueRectDeduce(corners, masks, ValBit(a) | ValBit(b),
+                                       guessing);
+                CHECK_STATUS(res, finished);
+                if (res == S_NORMAL && !config_.disableShorten)
+                  return S_NORMAL;
+              }
+            }
+          }
+        }
+      }
+    }
+
+    if (grids_.size() == 1 && variant_ == VT_NONE && cages_.empty()) {
+      res = BugDeduce(guessing);
+      CHECK_STATUS(res, finished);
+    }
+    return finished ? S_FINISHED : S_NORMAL;
+  }
+
+  // 矩形的四个角能否构成致命结构：包含任一个角的区域或笼子都须恰好包含两个
+  // 角。对普通数独，即四个角恰好位于两个宫格内，每个宫格两个。
+  bool IsDeadlyRect(const Coor corners[4]) const {
+    for (int ii = 0; ii < 4; ++ii) {
+      int cage = cellCage_[corners[ii].first * COLS + corners[ii].second];
+      if (cage >= 0) {
+        int cnt = 0;
+        for (int jj = 0; jj < 4; ++jj)
+          if (cellCage_[corners[jj].first * COLS + corners[jj].second] == cage)
+            ++cnt;
+        if (cnt != 2) return false;
+      }
+      const vector<int> &areas =
+          cellAreas_[corners[ii].first * COLS + corners[ii].second];
+      for (vector<int>::const_iterator ita = areas.begin();
+           ita != areas.end(); ++ita) {
+        int cnt = 0;
+        for (int jj = 0; jj < 4; ++jj)
+          if (InArea(corners[jj], *ita)) ++cnt;
+        if (cnt != 2) return false;
+      }
+    }
+    return true;
+  }
+
+  // 对四个角为corners、候选数分别为masks的矩形，以ab为公共数对进行唯一矩形
+  // 推导。
+  Status UniqueRectDeduce(const Coor corners[4], const ValMask masks[4],
+                          ValMask ab, bool guessing) {
+    vector<int> floors, roofs;
+    for (int ii = 0; ii < 4; ++ii)
+      (masks[ii] == ab ? floors : roofs).push_back(ii);
+    if (floors.size() < 2 || roofs.empty()) return S_FINISHED;
+
+    bool finished = true;
+    Status res;
+    CoorSet removed;
+    ValMask removedVals = 0;
+    int type = 0;
+
+    if (floors.size() == 3) {
+      // 类型1
+      const Coor &roof = corners[roofs[0]];
+      for (int val = 1; val <= SIZE; ++val) {
+        if (!HasVal(ab, val)) continue;
+        res = RemovePossible(roof.first, roof.second, val);
+        CHECK_STATUS(res, finished);
+      }
+      removed.insert(roof);
+      removedVals = ab;
+      type = 1;
+    } else {
+      const Coor &roof1 = corners[roofs[0]];
+      const Coor &roof2 = corners[roofs[1]];
+      ValMask extra1 = masks[roofs[0]] & ~ab;
+      ValMask extra2 = masks[roofs[1]] & ~ab;
+      CoorSet roofSet;
+      roofSet.insert(roof1);
+      roofSet.insert(roof2);
+
+      // 类型2
+      if (extra1 == extra2 && BitCount(extra1) == 1) {
+        res = RemoveFromPeers(roofSet, MaskToVal(extra1), removed);
+        CHECK_STATUS(res, finished);
+        removedVals = extra1;
+        type = 2;
+      }
+
+      // 类型4、类型3
+      vector<int> ids;
+      CommonAreas(roofSet, ids);
+      for (vector<int>::const_iterator iti = ids.begin();
+           iti != ids.end() && removed.empty(); ++iti) {
+        const Area &area = allAreas_[*iti];
+        for (int u = 1; u <= SIZE && removed.empty(); ++u) {
+          if (!HasVal(ab, u) || CountInArea(area, u) != 2) continue;
+          int v = MaskToVal(ab & ~ValBit(u));
+          for (CoorSet::const_iterator itc = roofSet.begin();
+               itc != roofSet.end(); ++itc) {
+            res = RemovePossible(itc->first, itc->second, v);
+            CHECK_STATUS(res, finished);
+            if (res == S_NORMAL) removed.insert(*itc);
+          }
+          removedVals = ValBit(v);
+          type = 4;
+        }
+        if (removed.empty()) {
+          res = UniqueRectType3(area, roofSet, extra1 | extra2, removed,
+                                removedVals);
+          CHECK_STATUS(res, finished);
+          type = 3;
+        }
+      }
+    }
+
+    if (finished) return S_FINISHED;
+    ++uniqueCnt_[type - 1];
+    if (ShowMsg(guessing))
+      ShowUniqueDeduceMsg(type, corners, ab, removed, removedVals);
+    return S_NORMAL;
+  }
+
+  // 唯一矩形类型3：两个顶多出的数字extra看作一个虚拟方格，在区域area内寻找
+  // 另外k-1个方格，使它们与虚拟方格的候选数之并集恰好包含k个数字。
+  Status UniqueRectType3(const Area &area, const CoorSet &roofSet,
+                         ValMask extra, CoorSet &removed,
+                         ValMask &removedVals) {
+    vector<Coor> cells;
+    for (vector<Coor>::const_iterator itc = area.cells.begin();
+         itc != area.cells.end(); ++itc) {
+      int xx = itc->first, yy = itc->second;
+      if (!mark_[xx][yy] && roofSet.find(Coor(xx, yy)) == roofSet.end())
+        cells.push_back(Coor(xx, yy));
+    }
+
+    int maxSize = min(3, (int)cells.size() - 1);
+    for (int l = max(BitCount(extra) - 1, 1); l <= maxSize; ++l) {
+      BoolVec tags(l, true);
+      tags.insert(tags.end(), cells.size() - l, false);
+      do {  // 遍历所有组合
+        ValMask vals = extra;
+        CoorSet coors;
+        for (int ii = 0; ii < (int)cells.size(); ++ii) {
+          if (!tags[ii]) continue;
+          vals |= board_[cells[ii].first][cells[ii].second];
+          coors.insert(cells[ii]);
+        }
+        if (BitCount(vals) != l + 1) continue;
+
+        bool finished = true;
+        Status res;
+        for (int ii = 0; ii < (int)cells.size(); ++ii) {
+          if (tags[ii]) continue;
+          for (int val = 1; val <= SIZE; ++val) {
+            if (!HasVal(vals, val)) continue;
+            res = RemovePossible(cells[ii].first, cells[ii].second, val);
+            CHECK_STATUS(res, finished);
+            if (res == S_NORMAL) removed.insert(cells[ii]);
+          }
+        }
+        if (!finished) {
+          removedVals = vals;
+          return S_NORMAL;
+        }
+      } while (prev_permutation(tags.begin(), tags.end()));
+    }
+    return S_FINISHED;
+  }
+
+  // BUG+1推导。
+  Status BugDeduce(bool guessing) {
+    Coor extra(-1, -1);
+    for (int xx = 0; xx < ROWS; ++xx) {
+      for (int yy = 0; yy < COLS; ++yy) {
+        if (mark_[xx][yy]) continue;
+        int len = BitCount(board_[xx][yy]);
+        if (len == 2) continue;
+        if (len != 3 || extra.first >= 0) return S_FINISHED;
+        extra = Coor(xx, yy);
+      }
+    }
+    if (extra.first < 0) return S_FINISHED;
+
+    const Area &row = AreaOf(extra.first, extra.second, AT_ROW);
+    vector<int> possible;
+    MaskToVals(board_[extra.first][extra.second], possible);
+    int target = NO_VAL;
+    for (vector<int>::const_iterator itp = possible.begin();
+         itp != possible.end(); ++itp)
+      if (CountInArea(row, *itp) == 3) target = *itp;
+    if (target == NO_VAL) return S_FINISHED;
+
+    bool finished = true;
+    Status res;
+    for (vector<int>::const_iterator itp = possible.begin();
+         itp != possible.end(); ++itp) {
+      if (*itp == target) continue;
+      res = RemovePossible(extra.first, extra.second, *itp);
+      CHECK_STATUS(res, finished);
+    }
+    ++uniqueCnt_[UR_TYPES];
+    if (ShowMsg(guessing))
+      cout << "BUG+1 除(" << extra.first+1 << "," << extra.second+1
+           << ")外均为双值方格；此方格只能是" << Num2Char(target) << "。"
+           << endl;
+    return finished ? S_FINISHED : S_NORMAL;
+  }
+
+  // 区域area内候选数包含val的未确定方格的个数。
+  int CountInArea(const Area &area, int val) const {
+    int cnt = 0;
+    for (vector<Coor>::const_iterator itc = area.cells.begin();
+         itc != area.cells.end(); ++itc) {
+      int xx = itc->first, yy = itc->second;
+      if (!mark_[xx][yy] && HasVal(board_[xx][yy], val)) ++cnt;
+    }
+    return cnt;
+  }
+
+  // 在棋盘范围内进行强制链推导（Nishio、方格强制链、区域强制链）：
+  //  对每个双值方格的两个候选数，以及每个在某区域内只有两个候选方格的数字
+  //  的两个位置，分别假设其中一种情况成立，只用唯一候选数法和隐性唯一候选数法
+  //  进行传播，然后撤销修改：
+  //  1.若某种情况导致矛盾，则另一种情况必然成立；
+  //  2.若某个候选数在两种情况下都被删除，则可以将它删除。
+  // 与猜测不同，这里的假设不会递归，也不会被计为猜测。
+  // 每次推导最多进行g_budget_forcing_deduce步传播（每处理一个区域为一步）。
+  Status ForcingDeduce(bool guessing) {
+    int budget = max(config_.budgetForcing, 1);
+
+    // 收集所有的二选一假设。
+    typedef pair<Coor, int> Assumption;
+    typedef pair<Assumption, Assumption> Alternative;
+    vector<Alternative> alternatives;
+    for (int xx = 0; xx < ROWS; ++xx) {
+      for (int yy = 0; yy < COLS; ++yy) {
+        const ValMask &possible = board_[xx][yy];
+        if (mark_[xx][yy] || BitCount(possible) != 2) continue;
+        int val1 = MaskToVal(possible);
+        int val2 = MaskToVal(possible & ~ValBit(val1));
+        alternatives.push_back(Alternative(
+            Assumption(Coor(xx, yy), val1), Assumption(Coor(xx, yy), val2)));
+      }
+    }
+    set<Alternative> found;
+    for (AreaVec::const_iterator ita = allAreas_.begin();
+         ita != allAreas_.end(); ++ita) {
+      for (int val = 1; val <= SIZE; ++val) {
+        vector<Coor> cells;
+        for (vector<Coor>::const_iterator itc = ita->cells.begin();
+             itc != ita->cells.end(); ++itc) {
+          int xx = itc->first, yy = itc->second;
+          if (!mark_[xx][yy] && HasVal(board_[xx][yy], val))
+            cells.push_back(Coor(xx, yy));
+        }
+        if (cells.size() != 2) continue;
+        Alternative alt(Assumption(cells[0], val), Assumption(cells[1], val));
+        if (found.insert(alt).second) alternatives.push_back(alt);
+      }
+    }
+
+    typedef pair<Coor, int> Candidate;
+    typedef set<Candidate> CandidateSet;
+    set<int> savedStack = areaStack_;
+    bool finished = true;
+    Status res;
+    for (vector<Alternative>::const_iterator itv = alternatives.begin();
+         itv != alternatives.end() && budget > 0; ++itv) {
+      const Assumption *assumptions[2] = {&itv->first, &itv->second};
+      bool failed[2];
+      CandidateSet removed[2];
+      for (int ii = 0; ii < 2; ++ii) {
+        const Coor &coor = assumptions[ii]->first;
+        size_t pos = trail_.size();
+        CoorSet coors;
+        coors.insert(coor);
+        failed[ii] =
+            (SetPossible(coors, ValBit(assumptions[ii]->second)) == S_FAILED ||
+             PropagateSingles(budget) == S_FAILED);
+        for (size_t jj = pos; jj < trail_.size(); ++jj) {
+          const TrailEntry &entry = trail_[jj];
+          for (int val = 1; val <= SIZE; ++val)
+            if (HasVal(entry.vals, val))
+              removed[ii].insert(Candidate(entry.coor, val));
+        }
+        Undo(pos);
+        areaStack_ = savedStack;
+      }
+
+      if (failed[0] && failed[1]) return S_FAILED;
+      CandidateSet common;
+      if (failed[0] || failed[1]) {
+        // 一种情况导致矛盾，另一种情况成立。
+        const Assumption &holds = *assumptions[failed[0] ? 1 : 0];
+        const ValMask &possible = board_[holds.first.first][holds.first.second];
+        for (int val = 1; val <= SIZE; ++val)
+          if (val != holds.second && HasVal(possible, val))
+            common.insert(Candidate(holds.first, val));
+      } else {
+        set_intersection(removed[0].begin(), removed[0].end(),
+                         removed[1].begin(), removed[1].end(),
+                         inserter(common, common.begin()));
+      }
+      if (common.empty()) continue;
+
+      for (CandidateSet::const_iterator itc = common.begin();
+           itc != common.end(); ++itc) {
+        res = RemovePossible(itc->first.first, itc->first.second, itc->second);
+        CHECK_STATUS(res, finished);
+      }
+      if (finished) continue;
+      if (ShowMsg(guessing))
+        ShowForcingDeduceMsg(itv->first, itv->second, failed, common);
+      if (!config_.disableShorten)
+        return S_NORMAL;
+    }
+
+    return finished ? S_FINISHED : S_NORMAL;
+  }
+
+  // 笼子推导：查表得到和为cage.sum的所有数值组合，去掉不包含已确定数值的、
+  // 用到了未确定方格中没有的数值的，以及与某个未确定方格的候选数不相交的
+  // 组合，未确定方格的候选数只能在其余组合中剩下的数值范围内。
+  Status CageDeduce(const Cage &cage, bool showMsg) {
+    ValMask placed = 0, open = 0;
+    vector<Coor> cells;
+    vector<ValMask> masks;
+    for (vector<Coor>::const_iterator itc = cage.cells.begin();
+         itc != cage.cells.end(); ++itc) {
+      int xx = itc->first, yy = itc->second;
+      ValMask mask = board_[xx][yy];
+      if (mark_[xx][yy]) {
+        if ((placed & mask) != 0) return S_FAILED;
+        placed |= mask;
+      } else {
+        cells.push_back(*itc);
+        masks.push_back(mask);
+        open |= mask;
+      }
+    }
+
+    const vector<ValMask> &combos = cageCombos_[cage.cells.size()][cage.sum];
+    bool found = false;
+    ValMask allowed = 0;
+    for (vector<ValMask>::const_iterator itm = combos.begin();
+         itm != combos.end(); ++itm) {
+      if ((*itm & placed) != placed) continue;
+      ValMask rest = *itm & ~placed;
+      if ((rest & ~open) != 0) continue;
+      bool fits = true;
+      for (size_t ii = 0; ii < masks.size() && fits; ++ii)
+        fits = (masks[ii] & rest) != 0;
+      if (!fits) continue;
+      found = true;
+      allowed |= rest;
+    }
+    if (!found) return S_FAILED;
+
+    bool finished = true;
+    Status res;
+    for (size_t ii = 0; ii < cells.size(); ++ii) {
+      ValMask removed = masks[ii] & ~allowed;
+      for (int val = 1; val <= SIZE && removed != 0; ++val) {
+        if (!HasVal(removed, val)) continue;
+        res = RemovePossible(cells[ii].first, cells[ii].second, val);
+        CHECK_STATUS(res, finished);
+      }
+    }
+    if (!finished && showMsg) ShowCageDeduceMsg(cage, allowed);
+    return finished ? S_FINISHED : S_NORMAL;
+  }
+
+  // 只使用唯一候选数法和隐性唯一候选数法处理待处理区域列表，直到无法继续
+  // 推导、出现矛盾或budget耗尽（每处理一个区域消耗一步）。
+  Status PropagateSingles(int &budget) {
+    Status res;
+    while (!areaStack_.empty() && budget > 0) {
+      int id = *areaStack_.begin();
+      areaStack_.erase(areaStack_.begin());
+      --budget;
+      if (id >= (int)allAreas_.size()) {
+        res = CageDeduce(cages_[id - allAreas_.size()], false);
+        if (res == S_FAILED) return S_FAILED;
+        continue;
+      }
+      const Area &area = allAreas_[id];
+
+      ValMask placed = 0, once = 0, twice = 0;
+      for (vector<Coor>::const_iterator itc = area.cells.begin();
+           itc != area.cells.end(); ++itc) {
+        int xx = itc->first, yy = itc->second;
+        ValMask mask = board_[xx][yy];
+        if (mark_[xx][yy]) {
+          placed |= mask;
+          continue;
+        }
+        if (BitCount(board_[xx][yy]) == 1) {
+          res = SetCell(xx, yy, MaskToVal(board_[xx][yy]));
+          if (res == S_FAILED) return S_FAILED;
+          placed |= mask;
+          continue;
+        }
+        twice |= once & mask;
+        once |= mask;
+      }
+
+      const ValMask full = FullMask(SIZE);
+      if (((placed | once) & full) != full) return S_FAILED;
+      ValMask single = once & ~twice & ~placed;
+      for (vector<Coor>::const_iterator itc = area.cells.begin();
+           itc != area.cells.end() && single != 0; ++itc) {
+        int xx = itc->first, yy = itc->second;
+        if (mark_[xx][yy]) continue;
+        ValMask mask = board_[xx][yy] & single;
+        if (mask == 0) continue;
+        if (BitCount(mask) > 1) return S_FAILED;
+        res = SetCell(xx, yy, MaskToVal(mask));
+        if (res == S_FAILED) return S_FAILED;
+        single &= ~mask;
+      }
+    }
+    return S_FINISHED;
+  }
+
+  template <typename TVec>
   static bool ChangeVecWithTags(TVec &vec, BoolVec &tags, int l) {
     typename TVec::iterator itv = vec.begin();
     int changesRemain = -1;
@@ -845,128 +3622,519 @@ class ShuduSolver {
   // 若OR_CELL被设置，则coors所指定方格的候选数只能在vals范围内；
   // 若OR_AREA被设置，则包含coors所指定方格的各个区域内，其他方格的候选数不会
   // 包含vals中的数值。
-  Status SetPossible(const CoorSet &coors, const NumSet &vals,
-                     AreaType orgat=AT_END, OperRange range=OR_ALL) {
+  Status SetPossible(const CoorSet &coors, const ValMask &vals,
+                     int orgArea=-1, OperRange range=OR_ALL) {
     bool finished = true;
+    int valCnt = BitCount(vals);
 
     if ((range & OR_CELL) != 0 && !coors.empty()) {
-      if (coors.size() > vals.size()) return S_FAILED;
+      if ((int)coors.size() > valCnt) return S_FAILED;
       for (CoorSet::const_iterator itc = coors.begin();
            itc != coors.end(); ++itc) {
-        NumSet &possible = board_[itc->first][itc->second];
-        bool cellModified = false;
-        for (NumSet::iterator itp = possible.begin();
-             itp != possible.end(); ) {
-          if (vals.find(*itp) == vals.end()) {
-            possible.erase(itp++);
-            cellModified = true;
-            finished = false;
-          } else {
-            ++itp;
-          }
-        }
-        if (possible.empty()) return S_FAILED;
-        if (cellModified)
-          for (AreaType t = AT_BEGIN; t < AT_END; ++t)
-            areaStack_.insert(CalcArea(itc->first, itc->second, t));
+        ValMask &possible = board_[itc->first][itc->second];
+        ValMask removed = possible & ~vals;
+        if (removed == 0) continue;
+        trail_.push_back(TrailEntry(*itc, removed));
+        possible &= vals;
+        finished = false;
+        if (possible == 0) return S_FAILED;
+        PushAreas(itc->first, itc->second);
       }
     }
 
-    if ((range & OR_AREA) != 0 && !vals.empty()) {
-      if (coors.size() < vals.size()) return S_FAILED;
-      for (AreaType at = AT_BEGIN; at < AT_END; ++at) {
-        if ((at == orgat && (range & OR_SAME_AREA) == 0) ||
-            (at != orgat && (range & OR_OTHER_AREA) == 0))
+    if ((range & OR_AREA) != 0 && valCnt > 0) {
+      if ((int)coors.size() < valCnt) return S_FAILED;
+      vector<int> ids;
+      CommonAreas(coors, ids);
+      for (vector<int>::const_iterator iti = ids.begin();
+           iti != ids.end(); ++iti) {
+        if ((*iti == orgArea && (range & OR_SAME_AREA) == 0) ||
+            (*iti != orgArea && (range & OR_OTHER_AREA) == 0))
           continue;
-        Area area;
-        if (!CalcArea(coors, at, area)) continue;
-        for (int xx = area.lt.first; xx < area.rb.first; ++xx) {
-          for (int yy = area.lt.second; yy < area.rb.second; ++yy) {
-            if (coors.find(Coor(xx, yy)) != coors.end()) continue;
-            NumSet &possible = board_[xx][yy];
-            bool cellModified = false;
-            for (NumSet::iterator itp = possible.begin();
-                 itp != possible.end(); ) {
-              if (vals.find(*itp) != vals.end()) {
-                possible.erase(itp++);
-                cellModified = true;
-                finished = false;
-              } else {
-                ++itp;
-              }
-            }
-            if (possible.empty()) return S_FAILED;
-            if (cellModified)
-              for (AreaType t = AT_BEGIN; t < AT_END; ++t)
-                areaStack_.insert(CalcArea(xx, yy, t));
-          }  // end of for yy in area
-        }  // end of for xx in area
-      }  // end of for at
+        const Area &area = allAreas_[*iti];
+        for (vector<Coor>::const_iterator itc = area.cells.begin();
+             itc != area.cells.end(); ++itc) {
+          int xx = itc->first, yy = itc->second;
+          if (coors.find(Coor(xx, yy)) != coors.end()) continue;
+          ValMask &possible = board_[xx][yy];
+          ValMask removed = possible & vals;
+          if (removed == 0) continue;
+          trail_.push_back(TrailEntry(Coor(xx, yy), removed));
+          possible &= ~vals;
+          finished = false;
+          if (possible == 0) return S_FAILED;
+          PushAreas(xx, yy);
+        }  // end of for cells in area
+      }  // end of for areas
     }
 
-    if (coors.size() == 1 && vals.size() == 1) {
+    if (coors.size() == 1 && valCnt == 1) {
       const Coor &coor = *coors.begin();
-      mark_[coor.first][coor.second] = true;
+      if (!mark_[coor.first][coor.second]) {
+        trail_.push_back(TrailEntry(coor, 0));
+        mark_[coor.first][coor.second] = true;
+      }
+    }
+
+    return finished ? S_FINISHED : S_NORMAL;
+  }
+
+  // 设置候选数，操作成功后：
+  // lines2所指定的列/行中，不在lines1所指定的行/列上的那些方格的
+  // 候选数不会包含val。
+  // 若rowFirst为true，则lines1指定行号，lines2指定列号。反之亦然。
+  Status SetPossible(const NumSet &lines1, const NumSet &lines2, int val,
+                     bool rowFirst) {
+    if (lines1.size() > lines2.size()) return S_FAILED;
+    if (lines1.size() < lines2.size()) return S_FINISHED;
+    bool finished = true;
+
+    for (int ii = 0; ii < SIZE; ++ii) {
+      if (lines1.find(ii) != lines1.end()) continue;
+      for (NumSet::const_iterator itl2 = lines2.begin();
+           itl2 != lines2.end(); ++itl2) {
+        int x = rowFirst ? ii : *itl2;
+        int y = rowFirst ? *itl2 : ii;
+        ValMask &possible = board_[x][y];
+        if (!HasVal(possible, val)) continue;
+        trail_.push_back(TrailEntry(Coor(x, y), ValBit(val)));
+        possible &= ~ValBit(val);
+        finished = false;
+        if (possible == 0) return S_FAILED;
+        PushAreas(x, y);
+      }
+    }
+
+    return finished ? S_FINISHED : S_NORMAL;
+  }
+
+  // 撤销修改记录中位置pos之后的所有修改，恢复到记录位置pos时的棋局，
+  // 并清空待处理区域列表。
+  void Undo(size_t pos) {
+    while (trail_.size() > pos) {
+      const TrailEntry &entry = trail_.back();
+      if (entry.vals == 0)
+        mark_[entry.coor.first][entry.coor.second] = false;
+      else
+        board_[entry.coor.first][entry.coor.second] |= entry.vals;
+      trail_.pop_back();
+    }
+    areaStack_.clear();
+  }
+
+  // 难度分级中的一级：在此前各级的基础上启用规则rule，等级为level。
+  struct GradeStage {
+    DeduceRule rule;
+    int level;
+
+    GradeStage(DeduceRule r, int l) : rule(r), level(l) { }
+  };
+  typedef vector<GradeStage> GradeStageVec;
+
+  // 按代价从低到高列出分级时逐级启用的规则。
+  // 显式和隐式链数互补，链列规则的行、列两个方向也互补，因此它们的等级
+  // 只需列到棋盘边长的一半。带鳍链列规则与链列规则共用等级。
+  void BuildGradeStages(const Config &base, GradeStageVec &stages) const {
+    int half = max(SIZE / 2, 1);
+    if (!base.disableNaked) stages.push_back(GradeStage(DR_NAKED, 1));
+    if (!base.disableHidden) stages.push_back(GradeStage(DR_HIDDEN, 1));
+    for (int level = 2; level <= half; ++level) {
+      if (!base.disableNaked && level <= base.levelNaked)
+        stages.push_back(GradeStage(DR_NAKED, level));
+      if (!base.disableHidden && level <= base.levelHidden)
+        stages.push_back(GradeStage(DR_HIDDEN, level));
+    }
+    if (!base.disableLines) {
+      for (int level = 2; level <= min(max(base.levelLines, 2), half);
+           ++level) {
+        stages.push_back(GradeStage(DR_LINES, level));
+        if (!base.disableFinned)
+          stages.push_back(GradeStage(DR_FINNED, level));
+      }
+    }
+    if (base.assumeUnique) stages.push_back(GradeStage(DR_UNIQUE, 1));
+    if (!base.disableWing) {
+      for (int level = 1; level <= min(max(base.levelWing, 1), 3); ++level)
+        stages.push_back(GradeStage(DR_WING, level));
+    }
+    if (!base.disableChain) {
+      for (int level = 2; level <= max(base.levelChain, 2); ++level)
+        stages.push_back(GradeStage(DR_CHAIN, level));
+    }
+    if (!base.disableAls) {
+      for (int level = 1; level <= min(max(base.levelAls, 1), SIZE-1); ++level)
+        stages.push_back(GradeStage(DR_ALS, level));
+    }
+    if (!base.disableForcing) stages.push_back(GradeStage(DR_FORCING, 1));
+  }
+
+  // 分级到第idx级时使用的配置：只启用前idx+1级所列的规则。
+  static Config StageConfig(const Config &base, const GradeStageVec &stages,
+                            int idx) {
+    Config config = base;
+    config.disableNaked = config.disableHidden = true;
+    config.disableLines = config.disableFinned = true;
+    config.disableWing = config.disableChain = true;
+    config.disableAls = config.disableForcing = true;
+    config.assumeUnique = false;
+    for (int ii = 0; ii <= idx; ++ii) {
+      int level = stages[ii].level;
+      switch (stages[ii].rule) {
+        case DR_NAKED:
+          config.disableNaked = false;
+          config.levelNaked = level;
+          break;
+        case DR_HIDDEN:
+          config.disableHidden = false;
+          config.levelHidden = level;
+          break;
+        case DR_LINES:
+          config.disableLines = false;
+          config.levelLines = level;
+          break;
+        case DR_FINNED:
+          config.disableFinned = false;
+          break;
+        case DR_UNIQUE:
+          config.assumeUnique = true;
+          break;
+        case DR_WING:
+          config.disableWing = false;
+          config.levelWing = level;
+          break;
+        case DR_CHAIN:
+          config.disableChain = false;
+          config.levelChain = level;
+          break;
+        case DR_ALS:
+          config.disableAls = false;
+          config.levelAls = level;
+          break;
+        case DR_FORCING:
+          config.disableForcing = false;
+          break;
+      }
+    }
+    return config;
+  }
+
+  // 是否显示推导信息（或棋局）。
+  bool ShowMsg(bool guessing) const {
+    if (config_.quiet) return false;
+    return guessing ? g_show_msg_guess : g_show_msg_deduce;
+  }
+  bool ShowBoard(bool guessing) const {
+    if (config_.quiet) return false;
+    return guessing ? g_show_board_guess : g_show_board_deduce;
+  }
+
+  // 记录规则rule的一次推导结果。
+  void CountRule(DeduceRule rule, Status res) {
+    if (res == S_NORMAL) ++ruleCnt_[rule];
+  }
+
+  // 删除方格(x, y)的候选数val，并将包含此方格的区域加入待处理区域列表。
+  // 返回S_NORMAL表示删除成功，S_FINISHED表示本来就没有此候选数，
+  // S_FAILED表示删除后方格没有候选数了。
+  Status RemovePossible(int x, int y, int val) {
+    ValMask &possible = board_[x][y];
+    ValMask bit = ValBit(val);
+    if ((possible & bit) == 0) return S_FINISHED;
+    trail_.push_back(TrailEntry(Coor(x, y), bit));
+    possible &= ~bit;
+    if (possible == 0) return S_FAILED;
+    PushAreas(x, y);
+    return S_NORMAL;
+  }
+
+  // 从同时与coors中所有方格相关的未确定方格中删除候选数val，
+  // 被删除了候选数的方格记录在removed中。
+  Status RemoveFromPeers(const CoorSet &coors, int val, CoorSet &removed) {
+    bool finished = true;
+    Status res;
+    for (int xx = 0; xx < ROWS; ++xx) {
+      for (int yy = 0; yy < COLS; ++yy) {
+        if (mark_[xx][yy] || !HasVal(board_[xx][yy], val)) continue;
+        Coor coor(xx, yy);
+        if (coors.find(coor) != coors.end() || !IsPeerOfAll(coor, coors))
+          continue;
+        res = RemovePossible(xx, yy, val);
+        CHECK_STATUS(res, finished);
+        removed.insert(coor);
+      }
+    }
+    return finished ? S_FINISHED : S_NORMAL;
+  }
+
+  // 设定方格(x, y)的值为val，并在此基础上进行推导。
+  // 返回true表示推导完成，false表示出现错误。
+  bool SetCellAndDeduce(int x, int y, int val) {
+    Status res;
+    res = SetCell(x, y, val);
+    if (res == S_FAILED) return false;
+    if (res == S_FINISHED) return true;
+    return Deduce(true);
+  }
+
+  // 寻找猜测的方格：第一个出现的候选数个数最少的未确定方格；分支策略为
+  // BP_DEGREE时，其中未确定的同行、列、宫格方格最多的优先。随机搜索时在
+  // 所有同样好的方格中等概率选择一个。cells不为NULL时只考虑其中的方格
+  // （从小到大排列的方格序号）。
+  // 返回false表示所有方格都已经确定。
+  bool FindGuessCell(int &x, int &y, const vector<int> *cells=NULL) const {
+    bool random = config_.randomBranch && random_ != NULL;
+    bool degree = config_.branch == BP_DEGREE;
+    int minlen = SIZE + 1, maxDegree = -1, ties = 0;
+    int cellCnt = cells != NULL ? cells->size() : ROWS * COLS;
+    x = y = -1;
+    for (int ii = 0; ii < cellCnt; ++ii) {
+      int cell = cells != NULL ? (*cells)[ii] : ii;
+      int xx = cell / COLS, yy = cell % COLS;
+      if (mark_[xx][yy]) continue;
+      int len = BitCount(board_[xx][yy]);
+      if (len > minlen) continue;
+      int deg = degree ? CountPeers(xx, yy, NO_VAL) : 0;
+      if (len < minlen || deg > maxDegree) {
+        minlen = len;
+        maxDegree = deg;
+        ties = 0;
+      } else if (deg < maxDegree || !random) {
+        continue;
+      }
+      // 水塘抽样：第ties个平局的方格以1/ties的概率替换已选的方格。
+      if (++ties == 1 || random_->Uniform(ties) == 0) {
+        x = xx;
+        y = yy;
+      }
+    }
+    return x >= 0;
+  }
+
+  // 统计方格(x, y)的同行、列、宫格的未确定方格中含有候选数val的数目，
+  // val为NO_VAL时统计全部未确定方格。
+  int CountPeers(int x, int y, int val) const {
+    int cnt = 0;
+    const vector<int> &peers = peers_[x * COLS + y];
+    for (vector<int>::const_iterator itp = peers.begin();
+         itp != peers.end(); ++itp)
+      cnt += IsOpen(*itp / COLS, *itp % COLS, val);
+    return cnt;
+  }
+
+  // 方格(x, y)是否未确定并且含有候选数val（val为NO_VAL时不限）。
+  bool IsOpen(int x, int y, int val) const {
+    if (mark_[x][y]) return false;
+    return val == NO_VAL || HasVal(board_[x][y], val);
+  }
+
+  // 搜索的一个分支：假设方格first的数值为second。
+  typedef pair<Coor, int> Branch;
+  typedef vector<Branch> BranchVec;
+  typedef pair<int, Branch> KeyedBranch;
+  struct LTKeyedBranch {
+    bool operator()(const KeyedBranch &branch1,
+                    const KeyedBranch &branch2) const {
+      return branch1.first < branch2.first;
+    }
+  };
+
+  // 按分支策略生成搜索的分支，各分支的解互不相同且覆盖了当前棋局的所有解。
+  // cells不为NULL时只在其中的方格（互相关联的一组方格，从小到大排列）内
+  // 假设。
+  // 返回false表示所有方格都已经确定。
+  bool FindBranches(BranchVec &branches,
+                    const vector<int> *cells=NULL) const {
+    int x, y;
+    if (!FindGuessCell(x, y, cells)) return false;
+    for (int val = 1; val <= SIZE; ++val)
+      if (HasVal(board_[x][y], val))
+        branches.push_back(Branch(Coor(x, y), val));
+    if (config_.branch == BP_HIDDEN) FindHiddenBranches(branches, cells);
+
+    if (random_ != NULL) random_->Shuffle(branches);
+    if (config_.branchLcv) {
+      // 最少约束优先：删除同行、列、宫格中的候选数越少，越可能有解。
+      vector<KeyedBranch> keyed;
+      for (BranchVec::const_iterator itb = branches.begin();
+           itb != branches.end(); ++itb)
+        keyed.push_back(make_pair(
+            CountPeers(itb->first.first, itb->first.second, itb->second),
+            *itb));
+      stable_sort(keyed.begin(), keyed.end(), LTKeyedBranch());
+      for (int ii = 0; ii < (int)keyed.size(); ++ii)
+        branches[ii] = keyed[ii].second;
+    }
+    return true;
+  }
+
+  // 寻找可能位置最少的区域和数值，若位置数比branches中的分支更少，则改为
+  // 对这些位置分支：此数值必定位于其中一个位置。
+  void FindHiddenBranches(BranchVec &branches,
+                          const vector<int> *cells) const {
+    int best = branches.size();
+    for (AreaVec::const_iterator ita = allAreas_.begin();
+         ita != allAreas_.end(); ++ita) {
+      vector<int> cnt(SIZE + 1, 0);
+      for (vector<Coor>::const_iterator itc = ita->cells.begin();
+           itc != ita->cells.end(); ++itc) {
+        int xx = itc->first, yy = itc->second;
+        if (mark_[xx][yy]) continue;
+        // 区域内的未确定方格总在同一组中。
+        if (cells != NULL &&
+            !binary_search(cells->begin(), cells->end(), xx * COLS + yy))
+          break;
+        const ValMask &possible = board_[xx][yy];
+        for (int val = 1; val <= SIZE; ++val)
+          if (HasVal(possible, val)) ++cnt[val];
+      }
+      for (int val = 1; val <= SIZE; ++val) {
+        if (cnt[val] == 0 || cnt[val] >= best) continue;
+        best = cnt[val];
+        branches.clear();
+        for (vector<Coor>::const_iterator itc = ita->cells.begin();
+             itc != ita->cells.end(); ++itc) {
+          int xx = itc->first, yy = itc->second;
+          if (IsOpen(xx, yy, val))
+            branches.push_back(Branch(Coor(xx, yy), val));
+        }
+      }
+    }
+  }
+
+  // 第run轮搜索（从1开始）允许的假设次数。
+  long long RestartLimit(int run) const {
+    long long unit = config_.restartNodes;
+    if (config_.restart == RS_LUBY) return unit * Luby(run);
+    double limit = unit;
+    for (int ii = 1; ii < run && limit < 1e15; ++ii) limit *= 1.5;
+    return (long long)limit;
+  }
+
+  // Luby序列的第i项（从1开始）：若i = 2^k - 1，则为2^(k-1)；
+  // 否则若2^(k-1) <= i < 2^k - 1，则为第i - 2^(k-1) + 1项。
+  static long long Luby(int i) {
+    int k = 1;
+    while ((1LL << k) - 1 < i) ++k;
+    if ((1LL << k) - 1 == i) return 1LL << (k - 1);
+    return Luby(i - (1 << (k - 1)) + 1);
+  }
+
+  // 假设方格(x, y)是val，计数此后的解（至多limit个），然后恢复棋局。
+  int CountBranch(int x, int y, int val, int limit) {
+    size_t trailPos = trail_.size();
+    int cnt = 0;
+    if (SetCellAndDeduce(x, y, val)) cnt = CountSolutions(limit);
+    Undo(trailPos);
+    return cnt;
+  }
+
+  // 计数未确定方格为cells（互相关联的一组方格）的部分的解，至多limit个。
+  // 按分支策略假设，每次假设并推导之后，剩余的方格可能分成互不相关的几组，
+  // 各组分别计数。假设次数达到nodeLimit_时中止，结果不完整。
+  long long CountComponent(const vector<int> &cells, long long limit) {
+    BranchVec branches;
+    if (!FindBranches(branches, &cells)) return 1;
+    size_t trailPos = trail_.size();
+    long long total = 0;
+    for (BranchVec::const_iterator itb = branches.begin();
+         itb != branches.end() && total < limit && !ReachNodeLimit(); ++itb) {
+      ++guessCnt_;
+      if (SetCellAndDeduce(itb->first.first, itb->first.second, itb->second))
+        total += CountComponents(cells, limit);
+      Undo(trailPos);
     }
+    return min(total, limit);
+  }
 
-    return finished ? S_FINISHED : S_NORMAL;
+  // 试探未确定方格为cells（互相关联的一组方格）的部分是否有解：至多假设
+  // PROBE_GUESSES次，这些假设不计入guessCnt_，也不显示推导过程。假设次数
+  // 用完时视为有解，留给之后的搜索确定。不改变棋局。
+  bool ProbeComponent(const vector<int> &cells) {
+    Config config = config_;
+    int guessCnt = guessCnt_;
+    long long nodeLimit = nodeLimit_;
+    config_.quiet = true;
+    nodeLimit_ = guessCnt_ + PROBE_GUESSES;
+    bool res = CountComponent(cells, 1) > 0 || aborted_;
+    config_ = config;
+    guessCnt_ = guessCnt;
+    nodeLimit_ = nodeLimit;
+    aborted_ = false;
+    return res;
   }
 
-  // 设置候选数，操作成功后：
-  // lines2所指定的列/行中，不在lines1所指定的行/列上的那些方格的
-  // 候选数不会包含val。
-  // 若rowFirst为true，则lines1指定行号，lines2指定列号。反之亦然。
-  Status SetPossible(const NumSet &lines1, const NumSet &lines2, int val,
-                     bool rowFirst) {
-    if (lines1.size() > lines2.size()) return S_FAILED;
-    if (lines1.size() < lines2.size()) return S_FINISHED;
-    bool finished = true;
+  // 将cells中尚未确定的方格分组后分别计数，返回各组解数目之积（至多limit）。
+  long long CountComponents(const vector<int> &cells, long long limit) {
+    vector<vector<int> > components;
+    SplitComponents(cells, components);
+    long long product = 1;
+    for (int ii = 0; ii < (int)components.size() && product > 0 && !aborted_;
+         ++ii)
+      product = min(product * CountComponent(components[ii], limit), limit);
+    return product;
+  }
 
-    for (int ii = 0; ii < SIZE; ++ii) {
-      if (lines1.find(ii) != lines1.end()) continue;
-      for (NumSet::const_iterator itl2 = lines2.begin();
-           itl2 != lines2.end(); ++itl2) {
-        int x = rowFirst ? ii : *itl2;
-        int y = rowFirst ? *itl2 : ii;
-        NumSet &possible = board_[x][y];
-        bool cellModified = false;
-        if (possible.find(val) != possible.end()) {
-          possible.erase(val);
-          cellModified = true;
-          finished = false;
+  // 将cells中尚未确定的方格按关联关系分组：同一区域或笼子内的未确定方格
+  // （互为相关方格）属于同一组。cells本身必须是若干个完整的组，从小到大
+  // 排列；各组也从小到大排列，并按第一个方格的顺序排列。
+  void SplitComponents(const vector<int> &cells,
+                       vector<vector<int> > &components) const {
+    // 只沿cells中未确定方格的相关方格扩展，代价与cells的大小成正比。
+    vector<char> seen(ROWS * COLS, false);
+    for (vector<int>::const_iterator itc = cells.begin();
+         itc != cells.end(); ++itc) {
+      if (seen[*itc] || mark_[*itc / COLS][*itc % COLS]) continue;
+      components.push_back(vector<int>(1, *itc));
+      vector<int> &component = components.back();
+      seen[*itc] = true;
+      for (int ii = 0; ii < (int)component.size(); ++ii) {
+        const vector<int> &peers = peers_[component[ii]];
+        for (vector<int>::const_iterator itp = peers.begin();
+             itp != peers.end(); ++itp) {
+          if (seen[*itp] || mark_[*itp / COLS][*itp % COLS]) continue;
+          seen[*itp] = true;
+          component.push_back(*itp);
         }
-        if (possible.empty()) return S_FAILED;
-        if (cellModified)
-          for (AreaType t = AT_BEGIN; t < AT_END; ++t)
-            areaStack_.insert(CalcArea(x, y, t));
       }
+      sort(component.begin(), component.end());
     }
+  }
 
-    return finished ? S_FINISHED : S_NORMAL;
+  // 规则宫格的划分：宫格按行优先的顺序编号。
+  void DefaultRegions(vector<int> &regions) const {
+    regions.resize(ROWS * COLS);
+    for (int xx = 0; xx < ROWS; ++xx)
+      for (int yy = 0; yy < COLS; ++yy)
+        regions[xx * COLS + yy] = (xx / BLOCKX) * (COLS / BLOCKY) + yy / BLOCKY;
   }
 
-  // 设定方格(x, y)的值为val，并在此基础上进行推导。
-  // 返回true表示推导完成，false表示出现错误。
-  bool SetCellAndDeduce(int x, int y, int val) {
-    Status res;
-    res = SetCell(x, y, val);
-    if (res == S_FAILED) return false;
-    if (res == S_FINISHED) return true;
-    return Deduce(true);
+  // 检查笼子cage是否已经正确求解了。
+  bool IsOK(const Cage &cage) const {
+    ValMask used = 0;
+    int sum = 0;
+    for (vector<Coor>::const_iterator itc = cage.cells.begin();
+         itc != cage.cells.end(); ++itc) {
+      int xx = itc->first, yy = itc->second;
+      if (!mark_[xx][yy]) return false;
+      int val = MaskToVal(board_[xx][yy]);
+      if (HasVal(used, val)) return false;
+      used |= ValBit(val);
+      sum += val;
+    }
+    return sum == cage.sum;
   }
 
-  // 检查方格(x, y)所在的类型为at的区域是否已经正确求解了。
-  bool IsOK(int x, int y, AreaType at) const {
-    Area area = CalcArea(x, y, at);
+  // 检查区域area是否已经正确求解了。
+  bool IsOK(const Area &area) const {
     vector<bool> occurs(SIZE+1, false);
 
-    for (int xx = area.lt.first; xx < area.rb.first; ++xx) {
-      for (int yy = area.lt.second; yy < area.rb.second; ++yy) {
-        if (!mark_[xx][yy] || board_[xx][yy].size() != 1) return false;
-        int val = *board_[xx][yy].begin();
-        if (occurs[val]) return false;
-        occurs[val] = true;
-      }
+    for (vector<Coor>::const_iterator itc = area.cells.begin();
+         itc != area.cells.end(); ++itc) {
+      int xx = itc->first, yy = itc->second;
+      if (!mark_[xx][yy] || BitCount(board_[xx][yy]) != 1) return false;
+      int val = MaskToVal(board_[xx][yy]);
+      if (occurs[val]) return false;
+      occurs[val] = true;
     }
 
     for (int val = 1; val <= SIZE; ++val) {
@@ -976,34 +4144,49 @@ class ShuduSolver {
     return true;
   }
 
-  void ShowNakedDeduceMsg(const CoorSet &coors, const NumSet &vals,
+  // 以逗号分隔依次输出掩码中的数值。
+  void ShowVals(const ValMask &vals) const {
+    bool first = true;
+    for (int val = 1; val <= SIZE; ++val) {
+      if (!HasVal(vals, val)) continue;
+      cout << (first ? "" : ",") << Num2Char(val);
+      first = false;
+    }
+  }
+
+  void ShowCageDeduceMsg(const Cage &cage, ValMask allowed) const {
+    cout << "笼子 ";
+    for (vector<Coor>::const_iterator itc = cage.cells.begin();
+         itc != cage.cells.end(); ++itc)
+      cout << "(" << itc->first+1 << "," << itc->second+1 << ")";
+    cout << "之和为" << cage.sum << "，未确定的方格中只能出现数字";
+    ShowVals(allowed);
+    cout << "；删除其他候选数。" << endl;
+  }
+
+  void ShowNakedDeduceMsg(const CoorSet &coors, const ValMask &vals,
                           const Area &area) const {
-    cout << "显式 " << AREA_TYPE_STR[area.at]
-         << "(" << area.lt.first+1 << "," << area.lt.second+1 << ")-"
-         << "(" << area.rb.first << "," << area.rb.second << ") ";
+    cout << "显式 ";
+    ShowArea(area);
     for (CoorSet::const_iterator itc = coors.begin();
          itc != coors.end(); ++itc)
       cout << "(" << itc->first+1 << "," << itc->second+1 << ")";
     cout << "中只能出现数字";
-    for (NumSet::const_iterator itv = vals.begin();
-         itv != vals.end(); ++itv)
-      cout << (itv == vals.begin() ? "" : ",") << Num2Char(*itv);
+    ShowVals(vals);
     cout << "；从其他方格中删除这些数。" << endl;
   }
 
-  void ShowHiddenDeduceMsg(const CoorSet &coors, const NumSet &vals,
+  void ShowHiddenDeduceMsg(const CoorSet &coors, const ValMask &vals,
                            const Area &area) const {
-    cout << "隐式 " << AREA_TYPE_STR[area.at]
-         << "(" << area.lt.first+1 << "," << area.lt.second+1 << ")-"
-         << "(" << area.rb.first << "," << area.rb.second << ") 数字";
-    for (NumSet::const_iterator itv = vals.begin();
-         itv != vals.end(); ++itv)
-      cout << (itv == vals.begin() ? "" : ",") << Num2Char(*itv);
+    cout << "隐式 ";
+    ShowArea(area);
+    cout << "数字";
+    ShowVals(vals);
     cout << "只能在";
     for (CoorSet::const_iterator itc = coors.begin();
          itc != coors.end(); ++itc)
       cout << "(" << itc->first+1 << "," << itc->second+1 << ")";
-    if (coors.size() == vals.size()) {
+    if ((int)coors.size() == BitCount(vals)) {
       cout << "中；删除这些方格的其他候选数" << endl;
     } else {
       cout << "中；从其他区域中删除这些数。" << endl;
@@ -1026,22 +4209,176 @@ class ShuduSolver {
          << "方格的候选数中删除" << Num2Char(val) << "。" << endl;
   }
 
+  void ShowFinnedDeduceMsg(int val, const NumSet &lines1, const NumSet &lines2,
+                           const CoorSet &fins, const CoorSet &removed,
+                           bool sashimi, bool rowFirst) const {
+    const char *type1 = rowFirst ? "行" : "列";
+    const char *type2 = rowFirst ? "列" : "行";
+    cout << (sashimi ? "刺身链列" : "带鳍链列") << " 数字" << Num2Char(val)
+         << "在第";
+    for (NumSet::const_iterator itl1 = lines1.begin();
+         itl1 != lines1.end(); ++itl1)
+      cout << (itl1 == lines1.begin() ? "" : ",") << *itl1+1;
+    cout << type1 << "里除鳍";
+    for (CoorSet::const_iterator itc = fins.begin(); itc != fins.end(); ++itc)
+      cout << "(" << itc->first+1 << "," << itc->second+1 << ")";
+    cout << "外只能出现在第";
+    for (NumSet::const_iterator itl2 = lines2.begin();
+         itl2 != lines2.end(); ++itl2)
+      cout << (itl2 == lines2.begin() ? "" : ",") << *itl2+1;
+    cout << type2 << "；从";
+    for (CoorSet::const_iterator itc = removed.begin();
+         itc != removed.end(); ++itc)
+      cout << "(" << itc->first+1 << "," << itc->second+1 << ")";
+    cout << "中删除" << Num2Char(val) << "。" << endl;
+  }
+
+  void ShowAlsDeduceMsg(const Als &als1, const Als &als2, int x, int z,
+                        const CoorSet &removed) const {
+    cout << "ALS-XZ ";
+    const Als *alss[2] = {&als1, &als2};
+    for (int ii = 0; ii < 2; ++ii) {
+      const CoorSet &cells = alss[ii]->cells;
+      for (CoorSet::const_iterator itc = cells.begin();
+           itc != cells.end(); ++itc)
+        cout << "(" << itc->first+1 << "," << itc->second+1 << ")";
+      cout << "[";
+      for (int val = 1; val <= SIZE; ++val)
+        if (HasVal(alss[ii]->vals, val)) cout << Num2Char(val);
+      cout << (ii == 0 ? "] " : "]");
+    }
+    cout << " 受限公共数" << Num2Char(x) << "；从";
+    for (CoorSet::const_iterator itc = removed.begin();
+         itc != removed.end(); ++itc)
+      cout << "(" << itc->first+1 << "," << itc->second+1 << ")";
+    cout << "中删除" << Num2Char(z) << "。" << endl;
+  }
+
+  void ShowUniqueDeduceMsg(int type, const Coor corners[4], ValMask ab,
+                           const CoorSet &removed, ValMask vals) const {
+    cout << "唯一矩形" << type << " ";
+    for (int ii = 0; ii < 4; ++ii)
+      cout << "(" << corners[ii].first+1 << "," << corners[ii].second+1 << ")";
+    cout << "数对";
+    for (int val = 1; val <= SIZE; ++val)
+      if (HasVal(ab, val)) cout << Num2Char(val);
+    cout << "；从";
+    for (CoorSet::const_iterator itc = removed.begin();
+         itc != removed.end(); ++itc)
+      cout << "(" << itc->first+1 << "," << itc->second+1 << ")";
+    cout << "中删除";
+    for (int val = 1; val <= SIZE; ++val)
+      if (HasVal(vals, val)) cout << Num2Char(val);
+    cout << "。" << endl;
+  }
+
+  void ShowForcingDeduceMsg(const pair<Coor, int> &assumption1,
+                            const pair<Coor, int> &assumption2,
+                            const bool failed[2],
+                            const set<pair<Coor, int> > &removed) const {
+    const pair<Coor, int> *assumptions[2] = {&assumption1, &assumption2};
+    cout << "强制链 ";
+    for (int ii = 0; ii < 2; ++ii) {
+      const Coor &coor = assumptions[ii]->first;
+      cout << (ii == 0 ? "" : "或") << "(" << coor.first+1 << ","
+           << coor.second+1 << ")是" << Num2Char(assumptions[ii]->second);
+      if (failed[ii]) cout << "（矛盾）";
+    }
+    cout << "；删除";
+    for (set<pair<Coor, int> >::const_iterator itr = removed.begin();
+         itr != removed.end(); ++itr)
+      cout << "(" << itr->first.first+1 << "," << itr->first.second+1 << ")"
+           << Num2Char(itr->second);
+    cout << "。" << endl;
+  }
+
+  void ShowWingDeduceMsg(const char *name, const CoorSet &cells, int val,
+                         const CoorSet &removed) const {
+    cout << name << " ";
+    for (CoorSet::const_iterator itc = cells.begin();
+         itc != cells.end(); ++itc)
+      cout << "(" << itc->first+1 << "," << itc->second+1 << ")";
+    cout << "；从";
+    for (CoorSet::const_iterator itc = removed.begin();
+         itc != removed.end(); ++itc)
+      cout << "(" << itc->first+1 << "," << itc->second+1 << ")";
+    cout << "中删除" << Num2Char(val) << "。" << endl;
+  }
+
+  void ShowChainDeduceMsg(const ChainGraph &graph, const vector<int> &path,
+                          const CoorSet &removed) const {
+    cout << XChainName(graph, path) << " 数字" << Num2Char(graph.val) << "：";
+    for (int ii = 0; ii < (int)path.size(); ++ii) {
+      const Coor &coor = graph.nodes[path[ii]];
+      if (ii > 0) cout << (ii % 2 == 1 ? "=" : "-");
+      cout << "(" << coor.first+1 << "," << coor.second+1 << ")";
+    }
+    cout << "；从";
+    for (CoorSet::const_iterator itc = removed.begin();
+         itc != removed.end(); ++itc)
+      cout << "(" << itc->first+1 << "," << itc->second+1 << ")";
+    cout << "中删除" << Num2Char(graph.val) << "。" << endl;
+  }
+
+  void ShowColoringDeduceMsg(int val, const CoorSet colored[2],
+                             const CoorSet &removed) const {
+    cout << "染色 数字" << Num2Char(val) << "：";
+    for (int cc = 0; cc < 2; ++cc) {
+      if (cc > 0) cout << "/";
+      for (CoorSet::const_iterator itc = colored[cc].begin();
+           itc != colored[cc].end(); ++itc)
+        cout << "(" << itc->first+1 << "," << itc->second+1 << ")";
+    }
+    cout << "；从";
+    for (CoorSet::const_iterator itc = removed.begin();
+         itc != removed.end(); ++itc)
+      cout << "(" << itc->first+1 << "," << itc->second+1 << ")";
+    cout << "中删除" << Num2Char(val) << "。" << endl;
+  }
+
   const int BLOCKX;   // 一个宫格占多少行
   const int BLOCKY;   // 一个宫格占多少列
-  const int SIZE;     // 棋盘边长（宫格大小）
-  Board board_;       // 棋局信息（记录每个方格的候选数）
+  const int SIZE;     // 子棋盘边长（宫格大小）
+  const int ROWS;     // 棋盘行数，只有一个子棋盘时等于SIZE
+  const int COLS;     // 棋盘列数，只有一个子棋盘时等于SIZE
+  Board board_;       // 棋局信息（记录每个方格的候选数掩码）
   Mark mark_;         // 棋局信息（记录每个方格是否已经确定）
   int solutionCnt_;   // 已经发现的可行解数目
-  set<Area, LTArea> areaStack_; // 记录尚需处理的区域
+  int guessCnt_;      // 搜索过程中做出的假设次数
+  int restartCnt_;    // 搜索过程中的重启次数
+  long long nodeLimit_; // guessCnt_达到此值时中止搜索，0表示不限制
+  bool aborted_;      // 搜索是否因为nodeLimit_而中止
+  Config config_;     // 推导和搜索的配置
+  Random *random_;    // 搜索时打乱候选数顺序用的随机数生成器，可以为NULL
+  set<int> areaStack_;          // 记录尚需处理的区域的序号
+  vector<TrailEntry> trail_;    // 棋局的修改记录，用于回溯
+  vector<int> region_;          // 每个方格所属宫格的序号，按行优先的顺序
+  vector<Coor> grids_;          // 各子棋盘左上角的坐标
+  BoolVec active_;              // 每个方格是否属于某个子棋盘
+  bool regular_;                // 宫格是否为规则的BLOCKX * BLOCKY矩形
+  Variant variant_;             // 变型数独的附加区域
+  AreaVec allAreas_;            // 棋盘上的全部区域，下标即区域的序号
+  vector<vector<int> > cellAreas_;  // 每个方格所在的各区域的序号
+  vector<BoolVec> peer_;        // peer_[i][j]表示方格i、j位于同一区域内
+  vector<vector<int> > peers_;  // 每个方格的相关方格，从小到大排列
+  vector<AreaPair> areaPairs_;  // 交集至少有两个方格的区域对
+  vector<Cage> cages_;          // 杀手数独的笼子
+  vector<int> cellCage_;        // 每个方格所属笼子的序号，-1表示没有
+  // cageCombos_[n][s]为n个互不相同的数值之和为s的所有组合的位掩码
+  vector<vector<vector<ValMask> > > cageCombos_;
+  int ruleCnt_[DR_END];             // 各规则的有效推导次数
+  int uniqueCnt_[UR_TYPES + 1];     // 唯一性规则各类型的推导次数
 
   void ShowAreaStack() const {
     cout << "areaStack_.size() = " << areaStack_.size() << endl;
-    for (set<Area, LTArea>::const_iterator it = areaStack_.begin();
+    for (set<int>::const_iterator it = areaStack_.begin();
          it != areaStack_.end(); ++it) {
-      const Area area = *it;
-      cout << AREA_TYPE_STR[area.at] << "("
-           << area.lt.first << ", " << area.lt.second << ")-("
-           << area.rb.first << ", " << area.rb.second << ")     ";
+      if (*it >= (int)allAreas_.size()) {
+        cout << "笼子#" << *it - allAreas_.size() + 1 << " ";
+      } else {
+        ShowArea(allAreas_[*it]);
+      }
+      cout << "    ";
     }
     cout << endl;
   }
@@ -1076,11 +4413,35 @@ void ShowHelp() {
       const FlagVar<int> &flagVar = g_flags_int[tag];
       cout.width(defValWidth);
       cout << left << flagVar.strDefVal << flagVar.desc;
+    } else if (g_flags_string.find(tag) != g_flags_string.end()) {
+      const FlagVar<string> &flagVar = g_flags_string[tag];
+      cout.width(defValWidth);
+      cout << left << flagVar.strDefVal << flagVar.desc;
     }
     cout << endl;
   }
 }
 
+// 根据g_marks建立字符到数值的映射。g_marks须至少有size个互不相同的字符。
+bool SetMarks(int size) {
+  fill(g_mark_nums, g_mark_nums + 256, NO_VAL);
+  if (g_marks.empty()) return true;
+  if ((int)g_marks.size() < size) {
+    cout << "棋盘边长为" << size << "，但只给出了" << g_marks.size()
+         << "个数值字符。" << endl;
+    return false;
+  }
+  for (int ii = 0; ii < (int)g_marks.size(); ++ii) {
+    int &num = g_mark_nums[(unsigned char)g_marks[ii]];
+    if (num != NO_VAL) {
+      cout << "数值字符" << g_marks[ii] << "重复出现。" << endl;
+      return false;
+    }
+    num = ii + 1;
+  }
+  return true;
+}
+
 bool Init(int argc, const char **argv, int &blockx, int &blocky) {
   int idx = 1;
   for (; idx < argc; ++idx) {
@@ -1105,6 +4466,10 @@ bool Init(int argc, const char **argv, int &blockx, int &blocky) {
       int &var = *g_flags_int[tag].pvar;
       var = atoi(val.c_str());
       cout << "设置" << tag << "为" << var << "。" << endl;
+    } else if (g_flags_string.find(tag) != g_flags_string.end()) {
+      string &var = *g_flags_string[tag].pvar;
+      var = val;
+      cout << "设置" << tag << "为\"" << var << "\"。" << endl;
     } else {
       cout << "无效的参数：" << tag << endl;
     }
@@ -1125,9 +4490,584 @@ bool Init(int argc, const char **argv, int &blockx, int &blocky) {
       blocky = by;
     }
   }
+  return SetMarks(blockx * blocky);
+}
+
+// 读入棋局之前以#开头的头部行。形如“#variant: diagonal,windoku”的行
+// 为棋局指定附加区域（见ParseVariant），并入variant中，其余的行忽略。
+void ReadHeader(Variant &variant) {
+  const string tag = "variant:";
+  while ((cin >> ws) && cin.peek() == '#') {
+    string line;
+    getline(cin, line);
+    string::size_type pos = line.find(tag);
+    if (pos != string::npos)
+      variant |= ParseVariant(line.substr(pos + tag.size()));
+  }
+}
+
+// 按puzzles/*.txt的格式从in读入rows行cols列的棋局：跳过空行和#开头的注释
+// 行，此后的每一行是一个棋盘行，行内的空白被忽略，多出的方格被忽略，缺少的
+// 方格视为空方格；读满rows行后即停止，不读入其后的说明文字等内容。返回false
+// 表示行数不足。
+bool ReadPuzzle(istream &in, int size, int rows, int cols,
+                vector<int> &givens) {
+  givens.assign(rows * cols, NO_VAL);
+  bool token = g_token_input || size > MAX_CHAR_VAL;
+  string line;
+  for (int xx = 0; xx < rows; ) {
+    if (!getline(in, line)) return false;
+    string::size_type pos = line.find_first_not_of(" \t\r");
+    if (pos == string::npos || line[pos] == '#') continue;
+    int *row = &givens[xx * cols];
+    int yy = 0;
+    if (token) {
+      istringstream iss(line.substr(pos));
+      string tok;
+      while (yy < cols && (iss >> tok)) row[yy++] = Token2Num(tok);
+    } else {
+      for (; pos < line.size() && yy < cols; ++pos) {
+        if (!isspace((unsigned char)line[pos]))
+          row[yy++] = Char2Num(line[pos]);
+      }
+    }
+    ++xx;
+  }
+  return true;
+}
+
+// 从标准输入读入一个rows行cols列的棋局，返回false表示输入不完整。设置了
+// g_puzzle_files时，标准输入的每一行是一个棋局文件名，从该文件读入棋局。
+bool ReadGivens(int size, int rows, int cols, vector<int> &givens) {
+  if (g_puzzle_files) {
+    string path;
+    string::size_type begin = string::npos;
+    while (begin == string::npos) {
+      if (!getline(cin, path)) return false;
+      begin = path.find_first_not_of(" \t\r");
+    }
+    path = path.substr(begin, path.find_last_not_of(" \t\r") + 1 - begin);
+    ifstream in(path.c_str());
+    if (!in || !ReadPuzzle(in, size, rows, cols, givens)) {
+      cout << "\n无法读入棋局文件" << path << "。" << endl;
+      return false;
+    }
+    return true;
+  }
+
+  int cellCnt = rows * cols;
+  givens.assign(cellCnt, NO_VAL);
+  if (g_token_input || size > MAX_CHAR_VAL) {
+    string token;
+    for (int ii = 0; ii < cellCnt; ++ii) {
+      if (!(cin >> token)) return false;
+      givens[ii] = Token2Num(token);
+    }
+  } else {
+    char c;
+    for (int ii = 0; ii < cellCnt; ++ii) {
+      if (!(cin >> c)) return false;
+      givens[ii] = Char2Num(c);
+    }
+  }
+  return true;
+}
+
+// 从标准输入读入宫格划分，每个方格用一个字符（或一个数）表示所属宫格，
+// 各宫格按第一次出现的顺序编号。返回false表示输入不完整。
+bool ReadRegions(int size, vector<int> &regions) {
+  regions.assign(size * size, -1);
+  map<string, int> labels;
+  bool token = g_token_input || size > MAX_CHAR_VAL;
+  for (int ii = 0; ii < size * size; ++ii) {
+    string label;
+    if (token) {
+      if (!(cin >> label)) return false;
+    } else {
+      char c;
+      if (!(cin >> c)) return false;
+      label = c;
+    }
+    if (labels.find(label) == labels.end()) {
+      int id = labels.size();
+      labels[label] = id;
+    }
+    regions[ii] = labels[label];
+  }
+  return true;
+}
+
+// 从标准输入读入cellCnt个方格的笼子划分和各笼子的数值之和。笼子划分的格式
+// 与宫格划分相同，.表示方格不属于任何笼子；各笼子按第一次出现的顺序编号，
+// 之后依次给出每个笼子的和。返回false表示输入不完整。
+bool ReadCages(int size, int cellCnt, vector<int> &cageOf,
+               vector<int> &sums) {
+  cageOf.assign(cellCnt, -1);
+  map<string, int> labels;
+  bool token = g_token_input || size > MAX_CHAR_VAL;
+  for (int ii = 0; ii < cellCnt; ++ii) {
+    string label;
+    if (token) {
+      if (!(cin >> label)) return false;
+    } else {
+      char c;
+      if (!(cin >> c)) return false;
+      label = c;
+    }
+    if (label == ".") continue;
+    if (labels.find(label) == labels.end()) {
+      int id = labels.size();
+      labels[label] = id;
+    }
+    cageOf[ii] = labels[label];
+  }
+  sums.assign(labels.size(), 0);
+  for (size_t ii = 0; ii < sums.size(); ++ii)
+    if (!(cin >> sums[ii])) return false;
+  return true;
+}
+
+// 候选数文件（铅笔标记）按行优先的顺序记录rows * cols个方格的候选数掩码，
+// 不参与求解的方格为0：
+//  文本格式：每行一个棋盘行，掩码用MaskToHex的十六进制表示，以空白分隔；
+//  二进制格式：以PENCIL_MAGIC和行数、列数、宫格大小（各一个字节）开头，
+//    每个掩码占(size + 7) / 8个字节，低字节在前。
+const char PENCIL_MAGIC[] = "SDPM";
+const int PENCIL_MAGIC_LEN = 4;
+
+bool WritePencil(const string &path, const vector<ValMask> &masks,
+                 int rows, int cols, int size, bool binary) {
+  ofstream out(path.c_str(), binary ? ios::out | ios::binary : ios::out);
+  if (!out) return false;
+  if (binary) {
+    out.write(PENCIL_MAGIC, PENCIL_MAGIC_LEN);
+    out.put(rows).put(cols).put(size);
+    int bytes = (size + 7) / 8;
+    for (size_t ii = 0; ii < masks.size(); ++ii) {
+      for (int bb = 0; bb < bytes; ++bb) {
+        int byte = 0;
+        for (int bit = 0; bit < 8; ++bit) {
+          int val = bb * 8 + bit + 1;
+          if (val <= size && HasVal(masks[ii], val)) byte |= 1 << bit;
+        }
+        out.put(byte);
+      }
+    }
+  } else {
+    for (int xx = 0; xx < rows; ++xx) {
+      for (int yy = 0; yy < cols; ++yy)
+        out << (yy == 0 ? "" : " ") << MaskToHex(masks[xx * cols + yy], size);
+      out << "\n";
+    }
+  }
+  return out.good();
+}
+
+// 读入候选数文件，根据开头是否为PENCIL_MAGIC自动识别格式。返回false表示
+// 文件不存在、不完整，或与棋盘的大小不符。
+bool ReadPencil(const string &path, int rows, int cols, int size,
+                vector<ValMask> &masks) {
+  ifstream in(path.c_str(), ios::in | ios::binary);
+  if (!in) return false;
+  masks.assign(rows * cols, 0);
+  char magic[PENCIL_MAGIC_LEN];
+  if (in.read(magic, PENCIL_MAGIC_LEN) &&
+      equal(magic, magic + PENCIL_MAGIC_LEN, PENCIL_MAGIC)) {
+    if (in.get() != rows || in.get() != cols || in.get() != size)
+      return false;
+    int bytes = (size + 7) / 8;
+    for (int ii = 0; ii < rows * cols; ++ii) {
+      for (int bb = 0; bb < bytes; ++bb) {
+        int byte = in.get();
+        if (byte == EOF) return false;
+        for (int bit = 0; bit < 8; ++bit) {
+          if ((byte & (1 << bit)) == 0) continue;
+          int val = bb * 8 + bit + 1;
+          if (val > size) return false;
+          masks[ii] |= ValBit(val);
+        }
+      }
+    }
+    return true;
+  }
+
+  in.clear();
+  in.seekg(0);
+  string hex;
+  for (int ii = 0; ii < rows * cols; ++ii)
+    if (!(in >> hex) || !HexToMask(hex, size, masks[ii])) return false;
   return true;
 }
 
+// 难度分级模式：依次读入棋局直到输入结束，每个棋局输出一行：
+// 序号 分类 最难的规则 规则等级 难度分数
+// 同一个求解器在各个棋局之间重复使用。
+int Grade(ShuduSolver &solver, int size) {
+  ShuduSolver::Config config = solver.GetConfig();
+  config.quiet = true;
+  solver.SetConfig(config);
+
+  vector<int> givens;
+  for (int cnt = 1; ReadGivens(size, size, size, givens); ++cnt) {
+    ShuduSolver::GradeInfo info;
+    if (solver.LoadGivens(givens) != S_FAILED) solver.Grade(info);
+    cout << cnt << " ";
+    solver.ShowGradeMsg(info);
+  }
+  return 0;
+}
+
+// 以一行文本输出一个棋局：边长不超过35时每个方格一个字符，否则为以空格
+// 分隔的十进制数；空方格为0。
+void PrintGivens(const vector<int> &givens, int size) {
+  bool tokens = size > MAX_CHAR_VAL;
+  for (int ii = 0; ii < (int)givens.size(); ++ii) {
+    if (tokens && ii > 0) cout << " ";
+    if (givens[ii] == NO_VAL) {
+      cout << "0";
+    } else {
+      cout << Num2Char(givens[ii]);
+    }
+  }
+  cout << endl;
+}
+
+// 检查删除棋局puzzle（须有唯一解）中第cell个方格的已知数之后，解是否仍然
+// 唯一：在删除后的棋局上搜索被删方格取其他数值的解，找不到则解唯一。
+// 不唯一时返回false，并在solution中记录找到的那个解。puzzle保持不变。
+bool CanRemoveClue(ShuduSolver &solver, int size, vector<int> &puzzle,
+                   int cell, vector<int> &solution) {
+  int val = puzzle[cell];
+  puzzle[cell] = NO_VAL;
+  bool found = solver.LoadGivens(puzzle) != S_FAILED &&
+      solver.FindOtherSolution(cell / size, cell % size, val, solution);
+  puzzle[cell] = val;
+  return !found;
+}
+
+// 启动一组工作线程并等待它们全部结束。
+template <typename Worker>
+void RunWorkers(const vector<Worker> &workers) {
+  vector<thread> threads;
+  for (int ii = 0; ii < (int)workers.size(); ++ii)
+    threads.push_back(thread(workers[ii]));
+  for (int ii = 0; ii < (int)threads.size(); ++ii) threads[ii].join();
+}
+
+// 出题时缓存的其他解：diff记录与完整棋局不同的方格，cnt为其中仍是已知数
+// 的方格数目。cnt为1时，删除那个已知数就会使这个解成为可行解。
+struct OtherSolution {
+  vector<bool> diff;
+  int cnt;
+};
+
+// 出题：先用随机顺序的搜索生成一个完整棋局，再按随机顺序逐个尝试删除已知数，
+// 只保留删除后解仍然唯一的那些删除，直到已知数不超过目标数目或无法再删除。
+// 检查唯一性时，在删除后的棋局上搜索被删方格取其他数值的解：找不到则解唯一。
+// 找到的其他解会被缓存，已知数只减不增，因此缓存一直有效；某个缓存的解除了
+// 待删方格外与所有已知数相符时，不必再搜索就可以知道这个删除不可行。
+// 返回true表示得到了满足目标数目和目标分类的棋局。
+bool GeneratePuzzle(ShuduSolver &solver, Random &random, int size,
+                    vector<int> &puzzle) {
+  ShuduSolver::Config base = solver.GetConfig();
+  solver.SetConfig(ShuduSolver::SearchConfig(base));
+
+  vector<int> empty(size * size, NO_VAL);
+  vector<int> grid;
+  solver.SetRandom(&random);
+  solver.LoadGivens(empty);
+  solver.Deduce();
+  solver.SolveDoubt();
+  solver.GetValues(grid);
+  solver.SetRandom(NULL);
+
+  vector<int> order(size * size);
+  for (int ii = 0; ii < size * size; ++ii) order[ii] = ii;
+  random.Shuffle(order);
+  puzzle = grid;
+  int clues = size * size;
+  vector<OtherSolution> others;
+  vector<int> solution;
+  for (int ii = 0; ii < (int)order.size(); ++ii) {
+    if (g_gen_clues > 0 && clues <= g_gen_clues) break;
+    int cell = order[ii];
+    bool known = false;
+    for (int jj = 0; jj < (int)others.size() && !known; ++jj)
+      known = others[jj].cnt == 1 && others[jj].diff[cell];
+    if (known) continue;
+
+    if (!CanRemoveClue(solver, size, puzzle, cell, solution)) {
+      OtherSolution other;
+      other.diff.assign(size * size, false);
+      other.cnt = 0;
+      for (int jj = 0; jj < size * size; ++jj) {
+        if (solution[jj] == grid[jj]) continue;
+        other.diff[jj] = true;
+        if (puzzle[jj] != NO_VAL) ++other.cnt;
+      }
+      others.push_back(other);
+      continue;
+    }
+    puzzle[cell] = NO_VAL;
+    --clues;
+    for (int jj = 0; jj < (int)others.size(); ++jj)
+      if (others[jj].diff[cell]) --others[jj].cnt;
+  }
+  solver.SetConfig(base);
+
+  if (g_gen_clues > 0 && clues > g_gen_clues) return false;
+  if (g_gen_grade.empty()) return true;
+  ShuduSolver::GradeInfo info;
+  solver.LoadGivens(puzzle);
+  solver.Grade(info);
+  return g_gen_grade.find(info.category) != string::npos;
+}
+
+// 出题的一个工作线程：依次生成第index, index+step, index+2*step...个棋局，
+// 使用种子g_seed+index，因此同样的参数总是得到同样的结果。
+struct GenWorker {
+  int blockx, blocky;
+  int index, step;
+  vector<vector<int> > *puzzles;
+
+  void operator()() const {
+    int size = blockx * blocky;
+    ShuduSolver solver(blockx, blocky);
+    ShuduSolver::Config config = solver.GetConfig();
+    config.quiet = true;
+    config.maxSolution = 1;
+    solver.SetConfig(config);
+    Random random(g_seed + index);
+
+    for (int ii = index; ii < (int)puzzles->size(); ii += step) {
+      vector<int> puzzle;
+      for (int tries = 0; tries < max(g_gen_tries, 1); ++tries) {
+        if (GeneratePuzzle(solver, random, size, puzzle)) {
+          (*puzzles)[ii] = puzzle;
+          break;
+        }
+      }
+    }
+  }
+};
+
+// 出题模式：用g_threads个线程生成g_generate个棋局，按顺序每行输出一个。
+// 在g_gen_tries次尝试内未能满足目标的棋局输出一行提示。
+int Generate(int blockx, int blocky) {
+  int size = blockx * blocky;
+  int threadCnt = max(g_threads, 1);
+  vector<vector<int> > puzzles(g_generate);
+  vector<GenWorker> workers(threadCnt);
+  for (int ii = 0; ii < threadCnt; ++ii) {
+    workers[ii].blockx = blockx;
+    workers[ii].blocky = blocky;
+    workers[ii].index = ii;
+    workers[ii].step = threadCnt;
+    workers[ii].puzzles = &puzzles;
+  }
+  RunWorkers(workers);
+
+  for (int ii = 0; ii < (int)puzzles.size(); ++ii) {
+    if (puzzles[ii].empty()) {
+      cout << "# 第" << ii + 1 << "个棋局未能满足目标。" << endl;
+    } else {
+      PrintGivens(puzzles[ii], size);
+    }
+  }
+  return 0;
+}
+
+// 化简的一个工作线程：检查cells中第index, index+step...个方格的已知数能否
+// 删除，结果记录在removable中。
+struct ReduceWorker {
+  ShuduSolver *solver;
+  int size;
+  vector<int> puzzle;
+  const vector<int> *cells;
+  vector<char> *removable;
+  int index, step;
+
+  void operator()() {
+    vector<int> solution;
+    for (int ii = index; ii < (int)cells->size(); ii += step)
+      (*removable)[ii] = CanRemoveClue(*solver, size, puzzle, (*cells)[ii],
+                                       solution);
+  }
+};
+
+// 将有唯一解的棋局化简为极小棋局，即删除任何一个已知数都会使解不唯一。
+// 按方格顺序逐个尝试删除已知数，每次由各线程并行检查接下来的几个已知数，
+// 检查都基于当前的棋局：第一个可以删除的已知数被删除，它之前的结果都有效。
+// 若删除某个已知数会使解不唯一，则在已知数更少的棋局中也是如此，因此它之后
+// 不能删除的已知数也不必再检查，只有可以删除的需要在删除之后重新检查。
+// 结果与逐个检查相同，与线程数无关。
+void ReducePuzzle(vector<ShuduSolver*> &solvers, int size,
+                  vector<int> &puzzle) {
+  vector<int> pending;
+  for (int ii = 0; ii < size * size; ++ii)
+    if (puzzle[ii] != NO_VAL) pending.push_back(ii);
+  while (!pending.empty()) {
+    int batch = min((int)solvers.size(), (int)pending.size());
+    vector<int> cells(pending.begin(), pending.begin() + batch);
+    vector<char> removable(batch, false);
+    vector<ReduceWorker> workers(batch);
+    for (int ii = 0; ii < batch; ++ii) {
+      workers[ii].solver = solvers[ii];
+      workers[ii].size = size;
+      workers[ii].puzzle = puzzle;
+      workers[ii].cells = &cells;
+      workers[ii].removable = &removable;
+      workers[ii].index = ii;
+      workers[ii].step = batch;
+    }
+    RunWorkers(workers);
+
+    vector<int> next;
+    bool removed = false;
+    for (int ii = 0; ii < batch; ++ii) {
+      if (!removable[ii]) continue;
+      if (removed) {
+        next.push_back(cells[ii]);
+      } else {
+        puzzle[cells[ii]] = NO_VAL;
+        removed = true;
+      }
+    }
+    next.insert(next.end(), pending.begin() + batch, pending.end());
+    pending.swap(next);
+  }
+}
+
+// 化简模式：依次读入棋局直到输入结束，每个棋局输出一行化简后的棋局。
+// 解不唯一的棋局输出一行提示。
+int Reduce(int blockx, int blocky) {
+  int size = blockx * blocky;
+  vector<ShuduSolver*> solvers;
+  for (int ii = 0; ii < max(g_threads, 1); ++ii) {
+    ShuduSolver *solver = new ShuduSolver(blockx, blocky);
+    ShuduSolver::Config config = solver->GetConfig();
+    config.quiet = true;
+    solver->SetConfig(ShuduSolver::SearchConfig(config));
+    solvers.push_back(solver);
+  }
+
+  vector<int> puzzle;
+  for (int cnt = 1; ReadGivens(size, size, size, puzzle); ++cnt) {
+    ShuduSolver &solver = *solvers[0];
+    ShuduSolver::Config config = solver.GetConfig();
+    config.maxSolution = 2;
+    solver.SetConfig(config);
+    int solutionCnt = 0;
+    if (solver.LoadGivens(puzzle) != S_FAILED && solver.Deduce()) {
+      solver.SolveDoubt();
+      solutionCnt = solver.GetSolutionCnt();
+    }
+    config.maxSolution = 1;
+    solver.SetConfig(config);
+    if (solutionCnt != 1) {
+      cout << "# 第" << cnt << "个棋局的解不唯一或无解。" << endl;
+      continue;
+    }
+    ReducePuzzle(solvers, size, puzzle);
+    PrintGivens(puzzle, size);
+  }
+
+  for (int ii = 0; ii < (int)solvers.size(); ++ii) delete solvers[ii];
+  return 0;
+}
+
+// 取样模式：读入一个棋局，输出g_sample个随机解，每行一个。
+int Sample(int blockx, int blocky) {
+  int size = blockx * blocky;
+  ShuduSolver solver(blockx, blocky);
+  ShuduSolver::Config config = solver.GetConfig();
+  config.quiet = true;
+  solver.SetConfig(ShuduSolver::SearchConfig(config));
+  Random random(g_seed);
+
+  vector<int> puzzle, solution;
+  if (!ReadGivens(size, size, size, puzzle)) return 1;
+  for (int ii = 0; ii < g_sample; ++ii) {
+    if (solver.LoadGivens(puzzle) == S_FAILED ||
+        !solver.SampleSolution(random, max(g_sample_limit, 1), solution)) {
+      cout << "# 棋局无解。" << endl;
+      return 1;
+    }
+    PrintGivens(solution, size);
+  }
+  return 0;
+}
+
+// 分支策略评测模式：读入棋局直到输入结束，对每一种分支策略和候选数顺序的
+// 组合，用同样的搜索配置依次求解所有棋局，每种组合输出一行：
+// 分支策略 候选数顺序 假设次数 无解棋局数 用时（毫秒）
+int Bench(int blockx, int blocky) {
+  int size = blockx * blocky;
+  vector<vector<int> > puzzles;
+  vector<int> puzzle;
+  while (ReadGivens(size, size, size, puzzle)) puzzles.push_back(puzzle);
+
+  ShuduSolver solver(blockx, blocky);
+  ShuduSolver::Config base = solver.GetConfig();
+  base.quiet = true;
+  base = ShuduSolver::SearchConfig(base);
+  cout << "# " << puzzles.size() << "个棋局" << endl;
+  for (int policy = 0; policy < BP_END; ++policy) {
+    for (int lcv = 0; lcv < 2; ++lcv) {
+      ShuduSolver::Config config = base;
+      config.branch = (BranchPolicy)policy;
+      config.branchLcv = lcv;
+      solver.SetConfig(config);
+      Random random(g_seed);
+      solver.SetRandom(config.randomBranch ? &random : NULL);
+
+      long long guessCnt = 0;
+      int failedCnt = 0;
+      chrono::steady_clock::time_point start = chrono::steady_clock::now();
+      for (int ii = 0; ii < (int)puzzles.size(); ++ii) {
+        int before = solver.GetGuessCnt();
+        bool solved = false;
+        if (solver.LoadGivens(puzzles[ii]) != S_FAILED && solver.Deduce()) {
+          solver.Search();
+          solved = solver.GetSolutionCnt() > 0;
+        }
+        guessCnt += solver.GetGuessCnt() - before;
+        if (!solved) ++failedCnt;
+      }
+      chrono::steady_clock::duration elapsed =
+          chrono::steady_clock::now() - start;
+      cout << BRANCH_POLICY_STR[policy] << " "
+           << (lcv ? "lcv" : "natural") << " " << guessCnt << " "
+           << failedCnt << " "
+           << chrono::duration_cast<chrono::milliseconds>(elapsed).count()
+           << endl;
+    }
+  }
+  return 0;
+}
+
+// 用完整棋局表求解已经设置好初始数据的棋局：输出至多g_max_solution个解
+// （计数模式下不输出），以及解的准确数目。
+int SolveByTable(const GridTable::Bits &bits, int blockx, int blocky) {
+  const GridTable &table = *GridTable::Find(blockx, blocky);
+  int solutionCnt = GridTable::Count(bits);
+  if (!g_count) {
+    ShuduSolver grid(blockx, blocky);
+    int idx = GridTable::Next(bits, 0);
+    for (int ii = 0; ii < g_max_solution && idx >= 0; ++ii) {
+      grid.LoadGivens(table.Grid(idx));
+      grid.PrintBoardMark("得到一个可行解：");
+      idx = GridTable::Next(bits, idx + 1);
+    }
+  }
+  if (solutionCnt == 0) {
+    cout << "\n此题无解。" << endl;
+  } else {
+    cout << "\n查表完毕，此题共有" << solutionCnt << "个可行解。" << endl;
+  }
+  return 0;
+}
+
 int main(int argc, const char **argv) {
   int blockx = 3;
   int blocky = 3;
@@ -1137,45 +5077,131 @@ int main(int argc, const char **argv) {
        << "列，棋盘边长" << size << "。" << endl;
   cout << "使用 --help 参数查看命令行格式。" << endl;
 
-  ShuduSolver solver(blockx, blocky);
+  if (g_grade) {
+    ShuduSolver solver(blockx, blocky);
+    return Grade(solver, size);
+  }
+  if (g_generate > 0) return Generate(blockx, blocky);
+  if (g_reduce) return Reduce(blockx, blocky);
+  if (g_sample > 0) return Sample(blockx, blocky);
+  if (g_bench) return Bench(blockx, blocky);
 
-  char c;
-  int val;
-  cout << "\n输入初始棋盘，每个方格用一个对应的字符表示，"
-       << "空方格用x或0表示：" << endl;
-  for (int x = 0; x < size; ++x) {
-    for (int y = 0; y < size; ++y) {
-      if (!(cin >> c)) exit(-1);
-      val = Char2Num(c);
-      if (solver.SetCell(x, y, val) == S_FAILED) {
-        cout << "\n输入有误或发生冲突：("
-             << x+1 << ", " << y+1 << ")不能设置为" << c << endl;
-        solver.PrintBoardAll("初始化之后：");
-        return -1;
-      }
+  // 武士数独只用于求解单个棋局，批量模式总是使用单个棋盘。
+  ShuduSolver solver(blockx, blocky, g_samurai);
+  int cellCnt = solver.GetRows() * solver.GetCols();
+  vector<int> givens;
+  if (!g_load_pencil.empty()) {
+    // 初始棋盘由候选数文件给出。
+  } else if (g_puzzle_files) {
+    cout << "\n输入棋局文件名：" << endl;
+  } else if (g_token_input || size > MAX_CHAR_VAL) {
+    cout << "\n输入初始棋盘，每个方格用一个十进制数表示，以空白分隔，"
+         << "空方格用x或0表示：" << endl;
+  } else {
+    cout << "\n输入初始棋盘，每个方格用一个对应的字符表示，"
+         << "空方格用x或0表示：" << endl;
+  }
+  Variant variant = ParseVariant(g_variant);
+  ReadHeader(variant);
+  solver.SetVariant(variant);
+  if (g_load_pencil.empty() &&
+      !ReadGivens(size, solver.GetRows(), solver.GetCols(), givens))
+    exit(-1);
+  if (g_jigsaw) {
+    cout << "\n输入宫格划分，每个方格用一个字符表示所属的宫格：" << endl;
+    vector<int> regions;
+    if (!ReadRegions(size, regions) || !solver.SetRegions(regions)) {
+      cout << "\n宫格划分有误：须恰好有" << size << "个宫格，每个宫格"
+           << size << "个方格。" << endl;
+      return -1;
+    }
+  }
+  if (g_killer) {
+    cout << "\n输入笼子划分，每个方格用一个字符表示所属的笼子，"
+         << ".表示不属于任何笼子；然后依次输入各笼子的和：" << endl;
+    vector<int> cageOf, sums;
+    if (!ReadCages(size, cellCnt, cageOf, sums) ||
+        !solver.SetCages(cageOf, sums)) {
+      cout << "\n笼子有误：每个笼子至多" << size
+           << "个方格，且其和须能由互不相同的数值组成。" << endl;
+      return -1;
+    }
+  }
+  if (!g_load_pencil.empty()) {
+    vector<ValMask> masks;
+    if (!ReadPencil(g_load_pencil, solver.GetRows(), solver.GetCols(), size,
+                    masks)) {
+      cout << "\n无法读入候选数文件" << g_load_pencil << "。" << endl;
+      return -1;
+    }
+    if (solver.LoadPencil(masks) == S_FAILED) {
+      cout << "\n候选数文件有误或发生冲突。" << endl;
+      solver.PrintBoardAll("初始化之后：");
+      return -1;
     }
+  } else if (solver.LoadGivens(givens) == S_FAILED) {
+    cout << "\n输入有误或发生冲突。" << endl;
+    solver.PrintBoardAll("初始化之后：");
+    return -1;
   }
   solver.PrintBoardAll("设置初始数据后得到：");
 
+  if (!g_disable_pre_check) {
+    ShuduSolver::CheckInfo info;
+    if (solver.PreCheck(info) == S_FAILED) {
+      cout << "\n预检查失败，初始数据存在矛盾：";
+      solver.ShowCheckMsg(info);
+      return -1;
+    }
+  }
+
+  GridTable::Bits bits;
+  if (solver.MatchTable(bits))
+    return SolveByTable(bits, blockx, blocky);
+
   cout << "开始推导：" << endl;
   if (!solver.Deduce()) {
     cout << "\n推导失败，初始数据会导致矛盾" << endl;
     solver.PrintBoardAll("推导结果：");
     return -1;
   }
+  if (!g_dump_pencil.empty()) {
+    vector<ValMask> masks;
+    solver.GetPencil(masks);
+    if (!WritePencil(g_dump_pencil, masks, solver.GetRows(), solver.GetCols(),
+                     size, g_pencil_binary))
+      cout << "\n无法写入候选数文件" << g_dump_pencil << "。" << endl;
+  }
 
   if (solver.IsOK()) {
     cout << "推导完毕，结果正确。" << endl;
     solver.PrintBoardMark("最后结果：");
+    if (g_show_stats) solver.ShowStats();
     return 0;
   }
 
   cout << "推导完毕，未能求解。\n" << endl;
   solver.PrintBoardAll("推导结果：");
-  if (g_disable_guess) return 0;
+  if (g_disable_guess) {
+    if (g_show_stats) solver.ShowStats();
+    return 0;
+  }
+
+  if (g_count) {
+    long long cnt = solver.CountSolutions(g_max_solution);
+    if (cnt < g_max_solution) {
+      cout << "计数完毕，此题共有" << cnt << "个可行解。" << endl;
+    } else {
+      cout << "此题至少有" << cnt << "个可行解。" << endl;
+    }
+    if (g_show_stats) solver.ShowStats();
+    return 0;
+  }
 
   cout << "开始搜索可行解：" << endl;
-  solver.SolveDoubt();
+  Random random(g_seed);
+  if (solver.GetConfig().randomBranch) solver.SetRandom(&random);
+  solver.Search();
   int solutionCnt = solver.GetSolutionCnt();
   if (solutionCnt == 0) {
     cout << "\n此题无解。" << endl;
@@ -1184,6 +5210,7 @@ int main(int argc, const char **argv) {
   } else {
     cout << "\n发现" << solutionCnt << "个可行解，中止搜索。" << endl;
   }
+  if (g_show_stats) solver.ShowStats();
 
   return 0;
 }
@@ -0,0 +1,125 @@
+#!/bin/bash
+# shudu4的回归测试：
+#  1.用puzzles/*.txt中的每个棋局在几组参数下运行，输出与golden/中保存的
+#    结果逐字节比较；
+#  2.检查棋局文件（ReadPuzzle）和候选数文件（WritePencil/ReadPencil）的读写。
+# 用法：run_tests.sh [--update]
+#  --update  重新生成golden/下的结果（须确认改动不应影响输出后再使用）。
+# 环境变量SHUDU指定已编译的程序，否则用CXX（默认g++）编译old/shudu4.cc。
+
+cd "$(dirname "$0")" || exit 1
+TESTS=$(pwd)
+ROOT=$(cd ../.. && pwd)
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+UPDATE=false
+[ "$1" = "--update" ] && UPDATE=true
+
+if [ -z "$SHUDU" ]; then
+  SHUDU=$TMP/shudu4
+  ${CXX:-g++} -O2 -pthread -o "$SHUDU" "$ROOT/old/shudu4.cc" || exit 1
+fi
+
+FAILED=0
+fail() {
+  echo "FAIL: $*"
+  FAILED=$((FAILED + 1))
+}
+
+# 各组参数的名称和参数。
+CONFIGS=(
+  "default|"
+  "stats|--show_stats --show_msg_guess"
+  "noshort|--show_stats --disable_shorten_deduce"
+  "level2|--show_stats --level_naked_deduce=2 --level_hidden_deduce=2"
+)
+
+# 1.输出比较
+cd "$ROOT" || exit 1
+for f in puzzles/*.txt; do
+  name=$(basename "$f" .txt)
+  for config in "${CONFIGS[@]}"; do
+    tag=${config%%|*}
+    golden=$TESTS/golden/$name.$tag.out
+    echo "$f" | "$SHUDU" --puzzle_files ${config#*|} > "$TMP/out" 2>&1
+    if $UPDATE; then
+      cp "$TMP/out" "$golden"
+    elif [ ! -f "$golden" ]; then
+      fail "缺少$golden"
+    elif ! cmp -s "$TMP/out" "$golden"; then
+      fail "$name ($tag) 输出与golden不同："
+      diff "$golden" "$TMP/out" | head -20
+    fi
+  done
+done
+$UPDATE && { echo "已更新golden/。"; exit 0; }
+
+# 只保留棋盘行，用于比较不同输入方式得到的结果。
+board() {
+  grep '^|'
+}
+
+# 2.棋局文件：注释、空行、行内空白、缺少的方格、说明文字，以及--marks。
+PUZZLE=puzzles/b01.txt
+head -9 "$PUZZLE" > "$TMP/plain.txt"
+{
+  echo "# 注释行"
+  echo
+  sed -n 1,4p "$PUZZLE" | sed 's/\(...\)\(...\)/\1 \2 /'
+  echo "   # 缩进的注释"
+  sed -n 5,9p "$PUZZLE" | sed 's/\**$//'
+  echo
+  echo "1 2 3 4 5 6 7 8 9"
+} > "$TMP/messy.txt"
+echo "$TMP/plain.txt" | "$SHUDU" --puzzle_files | board > "$TMP/plain.out"
+echo "$TMP/messy.txt" | "$SHUDU" --puzzle_files | board > "$TMP/messy.out"
+[ -s "$TMP/plain.out" ] || fail "ReadPuzzle: 没有输出"
+cmp -s "$TMP/plain.out" "$TMP/messy.out" ||
+    fail "ReadPuzzle: 带注释和短行的文件结果不同"
+
+tr '123456789*' 'abcdefghi.' < "$TMP/plain.txt" > "$TMP/marks.txt"
+echo "$TMP/marks.txt" | "$SHUDU" --puzzle_files --marks=abcdefghi | board |
+    tr 'abcdefghi' '123456789' > "$TMP/marks.out"
+cmp -s "$TMP/plain.out" "$TMP/marks.out" || fail "ReadPuzzle: --marks结果不同"
+
+head -5 "$PUZZLE" > "$TMP/short.txt"
+echo "$TMP/short.txt" | "$SHUDU" --puzzle_files | grep -q '无法读入棋局文件' ||
+    fail "ReadPuzzle: 行数不足时未报错"
+
+# 3.候选数文件：文本与二进制格式的写入、读回，以及损坏的文件。
+PENCIL_OPTS="--disable_guess --show_msg_deduce=false"
+for fmt in text binary; do
+  opts=$PENCIL_OPTS
+  [ $fmt = binary ] && opts="$opts --pencil_binary"
+  echo "$PUZZLE" | "$SHUDU" --puzzle_files $opts \
+      --dump_pencil="$TMP/$fmt.pm" > /dev/null
+  [ -s "$TMP/$fmt.pm" ] || { fail "WritePencil: 没有生成$fmt文件"; continue; }
+  "$SHUDU" $opts --load_pencil="$TMP/$fmt.pm" \
+      --dump_pencil="$TMP/$fmt.2.pm" < /dev/null > "$TMP/$fmt.out"
+  cmp -s "$TMP/$fmt.pm" "$TMP/$fmt.2.pm" ||
+      fail "ReadPencil: $fmt文件读回后再写入的内容不同"
+  if [ $fmt = binary ]; then
+    head -c 4 "$TMP/binary.pm" | grep -q '^SDPM$' ||
+        fail "WritePencil: 二进制文件缺少SDPM头"
+  fi
+done
+cmp -s <(board < "$TMP/text.out") <(board < "$TMP/binary.out") ||
+    fail "ReadPencil: 文本与二进制格式的结果不同"
+
+{ printf 'SDPX'; tail -c +5 "$TMP/binary.pm"; } > "$TMP/badmagic.pm"
+{ printf 'SDPM\012'; tail -c +6 "$TMP/binary.pm"; } > "$TMP/badsize.pm"
+head -c 50 "$TMP/binary.pm" > "$TMP/truncated.pm"
+head -c 200 "$TMP/text.pm" > "$TMP/truncated.txt"
+echo "1ff zz" > "$TMP/badhex.txt"
+for bad in badmagic.pm badsize.pm truncated.pm truncated.txt badhex.txt \
+           missing.pm; do
+  "$SHUDU" --load_pencil="$TMP/$bad" < /dev/null |
+      grep -q '无法读入候选数文件' || fail "ReadPencil: 未拒绝$bad"
+done
+
+if [ $FAILED -ne 0 ]; then
+  echo "$FAILED项测试失败。"
+  exit 1
+fi
+echo "全部测试通过。"